@@ -1,4 +1,10 @@
 #include <fstream>
+#include <sstream>
+#include <queue>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
 #include "MyTestMacros.h"
 #include "LibEps.h"
@@ -11,6 +17,12 @@
 #include "LibModel.h"
 #include "LibRay.h"
 #include "LibThreadPool.h"
+#include "LibAffinity.h"
+#include "LibMPMCQueue.h"
+#include "LibPickService.h"
+#include "LibParallel.h"
+#include "LibAsync.h"
+#include "LibQuantizedModel.h"
 
 typedef LibPoint<double> Pt;
 typedef LibTriangle<double> Trngl;
@@ -22,6 +34,229 @@ typedef LibModel<double>::Surface Srfc;
 typedef LibRay<double> Ray;
 typedef LibThreadPool TP;
 
+// every heap allocation of the test process is counted, so tests can check that a path doesn't allocate.
+// All plain, array, sized and aligned forms are replaced so that each delete matches its new
+static std::atomic<size_t> g_allocCount = 0;
+
+static void* CountedAlloc(size_t size) {
+	g_allocCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+static void* CountedAlloc(size_t size, std::align_val_t align) {
+	g_allocCount.fetch_add(1, std::memory_order_relaxed);
+	const size_t alignment = static_cast<size_t>(align);
+	size = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+	void* ptr = _aligned_malloc(size, alignment);
+#else
+	void* ptr = std::aligned_alloc(alignment, size);
+#endif
+	if (ptr) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+static void CountedFree(void* ptr, std::align_val_t) noexcept {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+void* operator new(size_t size) {
+	return CountedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+	return CountedAlloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+	return CountedAlloc(size, align);
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+	return CountedAlloc(size, align);
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t align) noexcept {
+	CountedFree(ptr, align);
+}
+
+void operator delete[](void* ptr, std::align_val_t align) noexcept {
+	CountedFree(ptr, align);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t align) noexcept {
+	CountedFree(ptr, align);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t align) noexcept {
+	CountedFree(ptr, align);
+}
+
+class CountTask : public Task {
+public:
+	CountTask(std::atomic<int>& count, int work) : m_count(count), m_work(work) {}
+
+	void Do() override {
+		volatile double sum = 0;
+		for (int i = 0; i < m_work; i++) {
+			sum = sum + std::sqrt(static_cast<double>(i));
+		}
+		m_count++;
+	}
+
+private:
+	std::atomic<int>& m_count;
+	int m_work;
+};
+
+// adds two children until depth runs out, so most tasks are pushed from inside the pool
+class SpawnTask : public Task {
+public:
+	SpawnTask(TP& tp, std::atomic<int>& count, int depth) : m_tp(tp), m_count(count), m_depth(depth) {}
+
+	void Do() override {
+		m_count++;
+		if (m_depth > 0) {
+			m_tp.AddTask(std::make_unique<SpawnTask>(m_tp, m_count, m_depth - 1));
+			m_tp.AddTask(std::make_unique<SpawnTask>(m_tp, m_count, m_depth - 1));
+		}
+	}
+
+private:
+	TP& m_tp;
+	std::atomic<int>& m_count;
+	int m_depth;
+};
+
+// divide and conquer sum, every level forks its left half and waits on it from inside the pool
+static long long ForkSum(TP& tp, long long first, long long last) {
+	if (last - first <= 1000) {
+		long long sum = 0;
+		for (long long i = first; i < last; i++) {
+			sum += i;
+		}
+		return sum;
+	}
+
+	long long mid = first + (last - first) / 2;
+	long long left = 0;
+	LibTaskGroup group(tp);
+	group.Run([&]() { left = ForkSum(tp, first, mid); });
+	long long right = ForkSum(tp, mid, last);
+	group.Wait();
+	return left + right;
+}
+
+// stands in for the GUI event loop: continuations posted to it run when the owning thread drains it
+class EventQueue {
+public:
+	void Post(std::coroutine_handle<> handle) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_handles.push(handle);
+		m_cv.notify_one();
+	}
+
+	void RunUntil(const std::atomic<bool>& isDone) {
+		while (!isDone) {
+			std::coroutine_handle<> handle;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (!m_cv.wait_for(lock, std::chrono::milliseconds(10), [this] { return !m_handles.empty(); })) {
+					continue;
+				}
+				handle = m_handles.front();
+				m_handles.pop();
+			}
+			handle.resume();
+		}
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::queue<std::coroutine_handle<>> m_handles;
+};
+
+static LibAsyncTask<int> AsyncSquare(TP& tp, int val) {
+	co_await LibAsync::ResumeOn(tp);
+	co_return val * val;
+}
+
+// load -> (index || normals) -> back to the event loop, like the viewer's model pipeline
+static LibAsyncTask<void> AsyncLoad(TP& tp, EventQueue& events, std::shared_ptr<Model>& res,
+	std::thread::id& installThread, std::atomic<bool>& isDone) {
+	co_await LibAsync::ResumeOn(tp, LibPriority::Background);
+	std::shared_ptr<Model> mdl = std::make_shared<Model>(Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-4));
+
+	std::vector<LibAsyncTask<void>> stages;
+	stages.push_back([](std::shared_ptr<Model> mdl, TP& tp) -> LibAsyncTask<void> {
+		mdl->BuildBVH(tp);
+		co_return;
+	}(mdl, tp));
+	stages.push_back([](std::shared_ptr<Model> mdl, TP& tp) -> LibAsyncTask<void> {
+		mdl->ComputeNormals(tp);
+		co_return;
+	}(mdl, tp));
+	co_await LibAsync::WhenAll(tp, std::move(stages));
+
+	co_await LibAsync::ResumeVia([&events](std::coroutine_handle<> handle) { events.Post(handle); });
+	res = mdl;
+	installThread = std::this_thread::get_id();
+	isDone = true;
+}
+
+// the submission queue LibThreadPool had before LibMPMCQueue, kept as the benchmark baseline
+template<typename T>
+class MutexQueue {
+public:
+	explicit MutexQueue(size_t) {}
+
+	bool TryPush(const T& val) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push(val);
+		return true;
+	}
+
+	bool TryPop(T& val) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_queue.empty()) {
+			return false;
+		}
+		val = m_queue.front();
+		m_queue.pop();
+		return true;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::queue<T> m_queue;
+};
+
 class Tests {
 private:
 	void PointTest_DistanceTo() {
@@ -389,6 +624,47 @@ private:
 		MY_ASSERT_FALSE(trngl.IsIntersectionLine(line, inters));
 	}
 
+	void TriangleTest_MollerTrumbore()
+	{
+		Pt p1(2, 0, 0);
+		Pt p2(2, 5, 0);
+		Pt p3(0, 0, 0);
+		Vec dir = Vec(1.26, 0.88, -1).GetNormalize();
+
+		double t, u, v;
+		MY_ASSERT_TRUE(LibTrnglKernel<double>::IsIntersection(Pt(0, 0, 1), dir, p1, p2, p3, t, u, v));
+		Pt inters = Pt(0, 0, 1) + t * dir;
+		MY_ASSERT_VEC_EQ(inters, Pt(1.26, 0.88, 0));
+		inters = p1 + u * (p2 - p1) + v * (p3 - p1);
+		MY_ASSERT_VEC_EQ(inters, Pt(1.26, 0.88, 0));
+
+		MY_ASSERT_FALSE(LibTrnglKernel<double>::IsIntersection(Pt(0, 0, 1), Vec(0.6, 0.2, 0).GetNormalize(), p1, p2, p3, t, u, v));
+		MY_ASSERT_FALSE(LibTrnglKernel<double>::IsIntersection(Pt(0, 0, 1), dir * (-1), p1, p2, p3, t, u, v));
+		MY_ASSERT_FALSE(LibTrnglKernel<double>::IsIntersection(Pt(3, 0, 1), dir, p1, p2, p3, t, u, v));
+
+		// a fan of 7 triangles: one full SIMD step and a scalar tail
+		std::vector<Pt> pts = { Pt(0, 0, 0) };
+		std::vector<Model::Index> trngls;
+		for (size_t i = 0; i <= 7; i++) {
+			pts.push_back(Pt(std::cos(i * M_PI / 4), std::sin(i * M_PI / 4), i * 0.1));
+		}
+		for (Model::Index i = 1; i <= 7; i++) {
+			trngls.insert(trngls.end(), { 0, i, i + 1 });
+		}
+
+		for (size_t i = 0; i < 7; i++) {
+			Pt target = Pt(0, 0, 0) + 0.3 * (pts[i + 1].AsVector() + pts[i + 2].AsVector());
+			Pt origin(0.1, -0.2, 3);
+			double dist = std::numeric_limits<double>::max();
+			size_t ind = 0;
+			MY_ASSERT_TRUE(LibTrnglKernel<double>::IsIntersectionRange(origin, (target - origin).GetNormalize(),
+				pts, trngls, 0, 7, dist, ind));
+			MY_ASSERT_EQ(i, ind);
+			Pt inters = origin + dist * (target - origin).GetNormalize();
+			MY_ASSERT_VEC_EQ(inters, target);
+		}
+	}
+
 	void ModelTest_CreateCube()
 	{
 		Pt center(0.5, 0.5, 0.5);
@@ -416,8 +692,8 @@ private:
 			Srfc(6, 8), Srfc(8, 10), Srfc(10, 12) };
 		MY_ASSERT_EQ(expSrfc, surfaces);
 
-		std::vector<size_t> triangles = cube.Triangles();
-		std::vector<size_t> expTr = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7, 8, 9, 10, 8, 10, 11,
+		std::vector<Model::Index> triangles = cube.Triangles();
+		std::vector<Model::Index> expTr = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7, 8, 9, 10, 8, 10, 11,
 		12, 13, 14, 12, 14, 15, 16, 17, 18, 16, 18, 19, 20, 21, 22, 20, 22, 23};
 		MY_ASSERT_EQ(expTr, triangles);
 	}
@@ -431,7 +707,7 @@ private:
 		MY_ASSERT_EQ(cylinder.Triangles().size(), 36);
 		MY_ASSERT_EQ(cylinder.Surfaces().size(), 3);
 
-		std::vector<size_t> exp = { 0, 2, 1, 0, 3, 2, 0, 1, 3,
+		std::vector<Model::Index> exp = { 0, 2, 1, 0, 3, 2, 0, 1, 3,
 			4, 5, 6, 4, 6, 7, 4, 7, 5,
 			1, 2, 6, 1, 6, 5, 2, 3, 7, 2, 7, 6, 3, 1, 5, 3, 5, 7 };
 		MY_ASSERT_EQ(exp, cylinder.Triangles());
@@ -545,6 +821,1431 @@ private:
 		MY_ASSERT_EQ(pt, pt3);
 		MY_ASSERT_EQ(srfc, srfc3);
 
+		TIMER_START("Big Cylinder build SAH BVH");
+		cylinder.BuildBVH();
+		TIMER_END("Big Cylinder build SAH BVH");
+
+		Pt pt4; int srfc4;
+		TIMER_START("Big Cylinder with SAH BVH");
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt4, srfc4, *cylinder.Accel()));
+		TIMER_END("Big Cylinder with SAH BVH");
+
+		MY_ASSERT_EQ(pt, pt4);
+		MY_ASSERT_EQ(srfc, srfc4);
+
+		TIMER_START("Big Cylinder build LBVH");
+		cylinder.BuildBVH(tp);
+		TIMER_END("Big Cylinder build LBVH");
+
+		Pt pt5; int srfc5;
+		TIMER_START("Big Cylinder with LBVH");
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt5, srfc5, *cylinder.Accel()));
+		TIMER_END("Big Cylinder with LBVH");
+
+		MY_ASSERT_EQ(pt, pt5);
+		MY_ASSERT_EQ(srfc, srfc5);
+	}
+
+	void ModelTest_BVHIntersRay() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		cube.BuildBVH();
+		MY_ASSERT_TRUE(cube.Accel() != nullptr);
+
+		Ray ray(Pt(1.22, 2, 1.5), Vec(-1.72, -2, -1.5));
+		Pt pt; int srfc;
+		MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, pt, srfc, *cube.Accel()));
+		MY_ASSERT_VEC_EQ(Pt(0.36, 1, 0.75), pt);
+		MY_ASSERT_EQ(3, srfc);
+
+		ray = Ray(Pt(0, 3, 1.5), Vec(-0.5, -3, -1.5));
+		MY_ASSERT_FALSE(cube.IsIntersectionRay(ray, pt, srfc, *cube.Accel()));
+
+		cube.SetPoints(cube.Points());
+		MY_ASSERT_TRUE(cube.Accel() == nullptr);
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+		cylinder.BuildBVH();
+		CompareAccelWithBruteForce(cylinder);
+
+		TP tp(4);
+		cylinder.BuildBVH(tp);
+		CompareAccelWithBruteForce(cylinder);
+
+		cube.BuildBVH(tp);
+		MY_ASSERT_TRUE(cube.IsIntersectionRay(Ray(Pt(1.22, 2, 1.5), Vec(-1.72, -2, -1.5)), pt, srfc, *cube.Accel()));
+		MY_ASSERT_VEC_EQ(Pt(0.36, 1, 0.75), pt);
+		MY_ASSERT_EQ(3, srfc);
+
+		// triangles at exponentially growing x: every SAH split peels off the farthest one, the tree
+		// still fits the traversal stack
+		std::vector<Pt> pts;
+		std::vector<Model::Index> trngls;
+		for (int i = 0; i < 300; i++) {
+			double x = std::pow(1.5, i);
+			pts.insert(pts.end(), { Pt(x, 0, 0), Pt(x, 1, 0), Pt(x, 0, 1) });
+			trngls.insert(trngls.end(), { Model::Index(3 * i), Model::Index(3 * i + 1), Model::Index(3 * i + 2) });
+		}
+		Model spread(pts, std::vector<Vec>(pts.size(), Vec(1, 0, 0)), trngls, { Srfc(0, 300) });
+		for (int i = 0; i < 2; i++) {
+			if (i == 0) {
+				spread.BuildBVH();
+			}
+			else {
+				spread.BuildBVH(tp);
+			}
+			const LibBVH<double, Model::Index>* bvh = dynamic_cast<const LibBVH<double, Model::Index>*>(spread.Accel());
+			MY_ASSERT_TRUE(bvh != nullptr);
+			MY_ASSERT_TRUE(bvh->Depth() < 128);
+			for (int k = 0; k < 80; k += 7) {
+				Ray ray(Pt(std::pow(1.5, k) - 0.1, 0.2, 0.2), Vec(1, 0, 0));
+				Pt expPt; int expSrfc;
+				MY_ASSERT_TRUE(spread.IsIntersectionRay(ray, expPt, expSrfc));
+				MY_ASSERT_TRUE(spread.IsIntersectionRay(ray, pt, srfc, *spread.Accel()));
+				MY_ASSERT_EQ(expPt, pt);
+			}
+		}
+	}
+
+	void ModelTest_GridIntersRay() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		cube.BuildGrid();
+
+		Ray ray(Pt(1.22, 2, 1.5), Vec(-1.72, -2, -1.5));
+		Pt pt; int srfc;
+		MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, pt, srfc, *cube.Accel()));
+		MY_ASSERT_VEC_EQ(Pt(0.36, 1, 0.75), pt);
+		MY_ASSERT_EQ(3, srfc);
+
+		ray = Ray(Pt(0, 3, 1.5), Vec(-0.5, -3, -1.5));
+		MY_ASSERT_FALSE(cube.IsIntersectionRay(ray, pt, srfc, *cube.Accel()));
+
+		ray = Ray(Pt(0.5, 0.5, 3), Vec(0, 0, -1));
+		MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, pt, srfc, *cube.Accel()));
+		MY_ASSERT_VEC_EQ(Pt(0.5, 0.5, 1), pt);
+		MY_ASSERT_EQ(1, srfc);
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+		cylinder.BuildGrid();
+		CompareAccelWithBruteForce(cylinder);
+	}
+
+	void ModelTest_TrnglCache() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		std::shared_ptr<const LibTrnglCache<double>> cache = cube.TrnglCache();
+		MY_ASSERT_EQ(12, cache->TrinaglesNum());
+		MY_ASSERT_EQ(3, cache->Blocks().size());
+		MY_ASSERT_TRUE(reinterpret_cast<uintptr_t>(cache->Blocks().data()) % 64 == 0);
+		MY_ASSERT_TRUE(cache == cube.TrnglCache());
+
+		Model copy = cube;
+		MY_ASSERT_TRUE(cache == copy.TrnglCache());
+
+		cube.SetPoints(cube.Points());
+		MY_ASSERT_TRUE(cache != cube.TrnglCache());
+		MY_ASSERT_TRUE(cache == copy.TrnglCache());
+
+		Ray ray(Pt(1.22, 2, 1.5), Vec(-1.72, -2, -1.5));
+		Pt pt; int srfc;
+		MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, pt, srfc));
+		MY_ASSERT_VEC_EQ(Pt(0.36, 1, 0.75), pt);
+		MY_ASSERT_EQ(3, srfc);
+
+		// every range split must give the same closest triangle as the full scan
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		cache = cylinder.TrnglCache();
+		size_t count = cylinder.TrinaglesNum();
+		for (int i = 0; i < 20; i++) {
+			double angle = 2 * M_PI * i / 20;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.15);
+			Vec dir = (Pt(0, 0, 1) - origin).GetNormalize();
+
+			double expDist = std::numeric_limits<double>::max();
+			size_t expInd = 0;
+			MY_ASSERT_TRUE(LibTrnglKernel<double>::IsIntersectionRange(origin, dir, cylinder.Points(), cylinder.Triangles(),
+				0, count, expDist, expInd));
+
+			double dist = std::numeric_limits<double>::max();
+			size_t ind = 0;
+			size_t mid = count / 2 + i;
+			cache->IsIntersectionRange(origin, dir, 0, mid, dist, ind);
+			cache->IsIntersectionRange(origin, dir, mid, count, dist, ind);
+			MY_ASSERT_EQ(expInd, ind);
+			MY_ASSERT_DOUBLE_EQ(expDist, dist);
+		}
+	}
+
+	void ModelTest_TrnglCacheConcurrent() {
+		// a background task builds the cache in chunks on its own worker. While it waits for them it picks up
+		// interactive tasks asking for the cache of the same model, they must not wait for the build
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 3e-8);
+		MY_ASSERT_TRUE(cylinder.TrinaglesNum() > 2 * (1 << 14));
+		Ray ray(Pt(3, 0.2, 1.1), Vec(-1, 0, 0));
+		Pt expPt; int expSrfc = -1;
+		MY_ASSERT_TRUE(Model(cylinder).IsIntersectionRay(ray, expPt, expSrfc));
+
+		TP tp(1);
+		const size_t tasksNum = 4;
+		std::vector<Pt> pts(tasksNum);
+		std::vector<int> srfcs(tasksNum, -1);
+		std::shared_ptr<const LibTrnglCache<double>> built;
+		LibTaskGroup background(tp, LibPriority::Background);
+		background.Run([&]() {
+			LibTaskGroup group(tp, LibPriority::Interactive);
+			for (size_t i = 0; i < tasksNum; i++) {
+				group.Run([&, i]() { cylinder.IsIntersectionRayTP(ray, pts[i], srfcs[i], tp); });
+			}
+			built = cylinder.TrnglCache(tp);
+			group.Wait();
+		});
+		background.Wait();
+
+		MY_ASSERT_TRUE(built == cylinder.TrnglCache());
+		for (size_t i = 0; i < tasksNum; i++) {
+			MY_ASSERT_EQ(expSrfc, srfcs[i]);
+			MY_ASSERT_VEC_EQ(expPt, pts[i]);
+		}
+	}
+
+	void ModelTest_IntersectRays() {
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+
+		std::vector<Ray> rays;
+		Pt eye(0.1, 0.2, 6);
+		for (int i = 0; i < 20; i++) {
+			for (int j = 0; j < 20; j++) {
+				rays.push_back(Ray(eye, Pt(-1.3 + i * 0.13, -1.3 + j * 0.13, 2) - eye));
+			}
+		}
+		for (int i = 0; i < 50; i++) {
+			Pt origin(4, -1 + i * 0.04, 0.1 + i * 0.035);
+			rays.push_back(Ray(origin, Vec(-1, 0.01 * i - 0.2, 0.003 * i)));
+		}
+		rays.push_back(Ray(Pt(0, 0, 3), Vec(0, 0, 1)));
+
+		std::vector<LibHit<double>> expHits(rays.size());
+		for (size_t i = 0; i < rays.size(); i++) {
+			expHits[i].m_isHit = cylinder.IsIntersectionRay(rays[i], expHits[i].m_pt, expHits[i].m_srfc);
+		}
+
+		CompareHits(cylinder, rays, expHits);
+
+		cylinder.BuildBVH();
+		CompareHits(cylinder, rays, expHits);
+
+		TP tp(4);
+		cylinder.BuildBVH(tp);
+		CompareHits(cylinder, rays, expHits);
+
+		cylinder.BuildGrid();
+		CompareHits(cylinder, rays, expHits);
+
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		std::vector<Ray> cubeRays = { Ray(Pt(1.22, 2, 1.5), Vec(-1.72, -2, -1.5)), Ray(Pt(0, 3, 1.5), Vec(-0.5, -3, -1.5)) };
+		std::vector<LibHit<double>> hits(cubeRays.size());
+		cube.IntersectRays(cubeRays, hits);
+		MY_ASSERT_TRUE(hits[0].m_isHit);
+		MY_ASSERT_VEC_EQ(Pt(0.36, 1, 0.75), hits[0].m_pt);
+		MY_ASSERT_EQ(3, hits[0].m_srfc);
+		MY_ASSERT_FALSE(hits[1].m_isHit);
+
+		// triangles hit at the same distance go to the lowest index
+		std::vector<Pt> pts = { Pt(0, 0, 0), Pt(1, 0, 0), Pt(0, 1, 0) };
+		std::vector<Vec> nrmls(3, Vec(0, 0, 1));
+		std::vector<Model::Index> trngls;
+		for (int i = 0; i < 6; i++) {
+			trngls.insert(trngls.end(), { 0, 1, 2 });
+		}
+		Model stacked(pts, nrmls, trngls, { Srfc(0, 6) });
+		std::vector<Ray> stackedRays(4, Ray(Pt(0.2, 0.3, 1), Vec(0, 0, -1)));
+		std::vector<LibHit<double>> stackedHits(stackedRays.size());
+		for (int i = 0; i < 2; i++) {
+			if (i == 1) {
+				stacked.BuildBVH();
+			}
+			stacked.IntersectRays(stackedRays, stackedHits);
+			for (const LibHit<double>& hit : stackedHits) {
+				MY_ASSERT_TRUE(hit.m_isHit);
+				MY_ASSERT_EQ(size_t(0), hit.m_trngl);
+			}
+		}
+	}
+
+	void ModelTest_Occlusion() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		Ray ray(Pt(0.5, 0.5, 3), Vec(0, 0, -1));
+		MY_ASSERT_TRUE(cube.IsOccluded(ray, 2.5));
+		MY_ASSERT_FALSE(cube.IsOccluded(ray, 1.5));
+		MY_ASSERT_FALSE(cube.IsOccluded(Ray(Pt(0.5, 0.5, 3), Vec(0, 0, 1)), 100));
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-4);
+		std::vector<Ray> rays;
+		std::vector<double> tMax;
+		std::vector<uint8_t> expOccluded;
+		for (int i = 0; i < 200; i++) {
+			double angle = 2 * M_PI * i / 200;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.015);
+			Pt target(0.3 * std::cos(angle * 3), 0.3 * std::sin(angle * 3), 1 + std::sin(angle * 5));
+			rays.push_back(Ray(origin, target - origin));
+
+			Pt pt; int srfc;
+			double dist = cylinder.IsIntersectionRay(rays.back(), pt, srfc) ? pt.DistanceTo(origin) : 10;
+			tMax.push_back(i % 2 == 0 ? dist * 0.9 : dist * 1.1);
+			expOccluded.push_back(i % 2 == 1 && dist < 10);
+		}
+
+		CompareOcclusion(cylinder, rays, tMax, expOccluded);
+
+		cylinder.BuildBVH();
+		CompareOcclusion(cylinder, rays, tMax, expOccluded);
+
+		TP tp(4);
+		cylinder.BuildBVH(tp);
+		CompareOcclusion(cylinder, rays, tMax, expOccluded);
+
+		cylinder.BuildGrid();
+		CompareOcclusion(cylinder, rays, tMax, expOccluded);
+	}
+
+	void ModelTest_IntersectAll() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		std::vector<LibHit<double>> hits;
+		MY_ASSERT_EQ(2, cube.IntersectAll(Ray(Pt(0.3, 0.6, 3), Vec(0, 0, -1)), hits));
+		MY_ASSERT_DOUBLE_EQ(2, hits[0].m_dist);
+		MY_ASSERT_DOUBLE_EQ(3, hits[1].m_dist);
+		MY_ASSERT_EQ(1, hits[0].m_srfc);
+		MY_ASSERT_EQ(0, hits[1].m_srfc);
+		for (const LibHit<double>& hit : hits) {
+			const Pt& A = cube.GetPtInTrngl(hit.m_trngl, 0);
+			Pt pt = A + hit.m_u * (cube.GetPtInTrngl(hit.m_trngl, 1) - A) + hit.m_v * (cube.GetPtInTrngl(hit.m_trngl, 2) - A);
+			MY_ASSERT_VEC_EQ(hit.m_pt, pt);
+		}
+
+		MY_ASSERT_EQ(0, cube.IntersectAll(Ray(Pt(0.3, 0.6, 3), Vec(0, 0, 1)), hits));
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-4);
+		std::vector<Ray> rays;
+		for (int i = 0; i < 50; i++) {
+			double angle = 2 * M_PI * i / 50;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.06);
+			rays.push_back(Ray(origin, Pt(0.2 * std::sin(angle), 0.1, 0.5 + i * 0.02) - origin));
+		}
+
+		std::vector<std::vector<LibHit<double>>> expHits(rays.size());
+		for (size_t i = 0; i < rays.size(); i++) {
+			MY_ASSERT_EQ(2, cylinder.IntersectAll(rays[i], expHits[i]));
+		}
+
+		cylinder.BuildBVH();
+		CompareAllHits(cylinder, rays, expHits);
+
+		cylinder.BuildGrid();
+		CompareAllHits(cylinder, rays, expHits);
+	}
+
+	void ModelTest_IntervalQuery() {
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		for (int i = 0; i < 3; i++) {
+			if (i == 1) {
+				cube.BuildBVH();
+			}
+			else if (i == 2) {
+				cube.BuildGrid();
+			}
+
+			Ray ray(Pt(0.3, 0.6, 3), Vec(0, 0, -2));
+			LibHit<double> hit;
+			MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, 0, std::numeric_limits<double>::max(), hit));
+			MY_ASSERT_DOUBLE_EQ(2, hit.m_dist);
+			MY_ASSERT_EQ(1, hit.m_srfc);
+
+			MY_ASSERT_TRUE(cube.IsIntersectionRay(ray, 2.5, std::numeric_limits<double>::max(), hit));
+			MY_ASSERT_DOUBLE_EQ(3, hit.m_dist);
+			MY_ASSERT_EQ(0, hit.m_srfc);
+			MY_ASSERT_VEC_EQ(Pt(0.3, 0.6, 0), hit.m_pt);
+
+			MY_ASSERT_FALSE(cube.IsIntersectionRay(ray, 0, 2, hit));
+			MY_ASSERT_FALSE(cube.IsIntersectionRay(ray, 2.1, 2.9, hit));
+
+			MY_ASSERT_FALSE(cube.IsIntersectionSegment(LibSegment<double>(Pt(0.3, 0.6, 3), Pt(0.3, 0.6, 1.5)), hit));
+			MY_ASSERT_FALSE(cube.IsOccluded(LibSegment<double>(Pt(0.3, 0.6, 3), Pt(0.3, 0.6, 1.5))));
+			MY_ASSERT_TRUE(cube.IsIntersectionSegment(LibSegment<double>(Pt(0.3, 0.6, 3), Pt(0.3, 0.6, 0.5)), hit));
+			MY_ASSERT_DOUBLE_EQ(2, hit.m_dist);
+			MY_ASSERT_TRUE(cube.IsOccluded(LibSegment<double>(Pt(0.3, 0.6, 3), Pt(0.3, 0.6, 0.5))));
+			MY_ASSERT_TRUE(cube.IsIntersectionSegment(LibSegment<double>(Pt(0.3, 0.6, 0.5), Pt(0.3, 0.6, -1)), hit));
+			MY_ASSERT_DOUBLE_EQ(0.5, hit.m_dist);
+			MY_ASSERT_EQ(0, hit.m_srfc);
+		}
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-4);
+		std::vector<Ray> rays;
+		std::vector<std::vector<LibHit<double>>> allHits(50);
+		for (int i = 0; i < 50; i++) {
+			double angle = 2 * M_PI * i / 50;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.06);
+			rays.push_back(Ray(origin, Pt(0.2 * std::sin(angle), 0.1, 0.5 + i * 0.02) - origin));
+			MY_ASSERT_EQ(2, cylinder.IntersectAll(rays.back(), allHits[i]));
+		}
+
+		for (int i = 0; i < 3; i++) {
+			if (i == 1) {
+				cylinder.BuildBVH();
+			}
+			else if (i == 2) {
+				cylinder.BuildGrid();
+			}
+
+			for (size_t j = 0; j < rays.size(); j++) {
+				LibHit<double> hit;
+				double tMin = allHits[j][0].m_dist + 1e-6;
+				MY_ASSERT_TRUE(cylinder.IsIntersectionRay(rays[j], tMin, std::numeric_limits<double>::max(), hit));
+				MY_ASSERT_EQ(allHits[j][1].m_trngl, hit.m_trngl);
+				MY_ASSERT_DOUBLE_EQ(allHits[j][1].m_dist, hit.m_dist);
+
+				// the far end stops short of the second crossing, whose distance may differ in the last bit
+				MY_ASSERT_FALSE(cylinder.IsIntersectionRay(rays[j], tMin, allHits[j][1].m_dist - 1e-6, hit));
+			}
+		}
+	}
+
+	void ThreadPoolTest_WorkStealing() {
+		TP tp(4);
+		MY_ASSERT_EQ(4, tp.ThreadsNum());
+
+		std::atomic<int> count = 0;
+		for (int i = 0; i < 10000; i++) {
+			tp.AddTask(std::make_unique<CountTask>(count, 10));
+		}
+		tp.WaitForFinish();
+		MY_ASSERT_EQ(10000, count);
+
+		count = 0;
+		tp.AddTask(std::make_unique<SpawnTask>(tp, count, 12));
+		tp.WaitForFinish();
+		MY_ASSERT_EQ((1 << 13) - 1, count);
+
+		tp.WaitForFinish();
+		tp.StopPool();
+	}
+
+	void ThreadPoolTest_TaskGroups() {
+		TP tp(2);
+		std::promise<void> gate;
+		std::shared_future<void> isOpen = gate.get_future().share();
+		std::future<int> slow = tp.Submit([isOpen]() {
+			isOpen.wait();
+			return 1;
+		});
+
+		// one worker is held by the slow job, the group only waits for its own tasks
+		std::atomic<int> count = 0;
+		{
+			LibTaskGroup group(tp);
+			for (int i = 0; i < 100; i++) {
+				group.AddTask(std::make_unique<CountTask>(count, 10));
+			}
+			group.Run([&count]() { count += 100; });
+			group.Wait();
+			MY_ASSERT_EQ(200, count);
+		}
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		Ray ray = Ray(Pt(1.5, -1.5, 2.7), Vec(-3, 3, -1.7));
+		Pt pt, pt2; int srfc, srfc2;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRayTP(ray, pt, srfc, tp));
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt2, srfc2));
+		MY_ASSERT_EQ(pt2, pt);
+		MY_ASSERT_EQ(srfc2, srfc);
+
+		MY_ASSERT_TRUE(slow.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+		gate.set_value();
+		MY_ASSERT_EQ(1, slow.get());
+
+		std::future<double> res = tp.Submit([]() { return std::sqrt(2.0); });
+		MY_ASSERT_DOUBLE_EQ(std::sqrt(2.0), res.get());
+
+		std::future<void> fail = tp.Submit([]() { throw std::runtime_error("task failed"); });
+		bool isThrown = false;
+		try {
+			fail.get();
+		}
+		catch (const std::runtime_error&) {
+			isThrown = true;
+		}
+		MY_ASSERT_TRUE(isThrown);
+	}
+
+	void ParallelTest_ForReduce() {
+		TP tp(4);
+		std::vector<int> visits(100000, 0);
+		LibParallel::For(tp, 10, visits.size(), 1000, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				visits[i]++;
+			}
+		});
+		MY_ASSERT_EQ(0, visits[9]);
+		MY_ASSERT_TRUE(std::all_of(visits.begin() + 10, visits.end(), [](int val) { return val == 1; }));
+
+		LibParallel::ForEach(tp, 0, visits.size(), 1 << 20, [&](size_t i) { visits[i]++; });
+		MY_ASSERT_EQ(1, visits[9]);
+		MY_ASSERT_EQ(2, visits.back());
+
+		auto sum = [](size_t first, size_t last) {
+			uint64_t res = 0;
+			for (size_t i = first; i < last; i++) {
+				res += i;
+			}
+			return res;
+		};
+		auto add = [](uint64_t a, uint64_t b) { return a + b; };
+		MY_ASSERT_EQ(uint64_t(999999) * 1000000 / 2, LibParallel::Reduce(tp, 0, 1000000, 100, uint64_t(0), sum, add));
+		MY_ASSERT_EQ(uint64_t(7), LibParallel::Reduce(tp, 5, 5, 100, uint64_t(7), sum, add));
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+		LibAABB<double> box = cylinder.BoundingBox(tp);
+		MY_ASSERT_VEC_EQ(cylinder.BoundingBox().Min(), box.Min());
+		MY_ASSERT_VEC_EQ(cylinder.BoundingBox().Max(), box.Max());
+		MY_ASSERT_VEC_EQ(box.Diagonal(), cylinder.Diagonal());
+		MY_ASSERT_VEC_EQ(Vec(0, 0, 0), Model().Diagonal());
+
+		Ray ray = Ray(Pt(1.5, -1.5, 2.7), Vec(-3, 3, -1.7));
+		Pt pt, pt2, pt3; int srfc, srfc2, srfc3;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt, srfc));
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRayTP(ray, pt2, srfc2, tp));
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRayThread(ray, pt3, srfc3));
+		MY_ASSERT_EQ(pt, pt2);
+		MY_ASSERT_EQ(pt, pt3);
+		MY_ASSERT_EQ(srfc, srfc2);
+		MY_ASSERT_EQ(srfc, srfc3);
+	}
+
+	void ModelTest_ComputeNormals() {
+		TP tp(4);
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		cube.ComputeNormals(tp);
+		MY_ASSERT_EQ(cube.Points().size(), cube.Normals().size());
+
+		// faces z = 0, z = 1, y = 0, y = 1, x = 0, x = 1, four points each
+		std::vector<Vec> expNormals = { Vec(0, 0, -1), Vec(0, 0, 1), Vec(0, -1, 0), Vec(0, 1, 0), Vec(-1, 0, 0), Vec(1, 0, 0) };
+		for (size_t i = 0; i < cube.Normals().size(); i++) {
+			MY_ASSERT_VEC_EQ(expNormals[i / 4], cube.Normals()[i]);
+		}
+
+		// the cap centre is shared by all cap triangles
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		cylinder.ComputeNormals(tp);
+		MY_ASSERT_VEC_EQ(Vec(0, 0, -1), cylinder.Normals()[0]);
+	}
+
+	// a stored float model is read back bit for bit, LibVector::operator== is a tolerance test
+	template<typename T>
+	static bool SameBits(const LibModel<T>& a, const LibModel<T>& b) {
+		auto same = [](const auto& x, const auto& y) { return x.X() == y.X() && x.Y() == y.Y() && x.Z() == y.Z(); };
+		if (!same(a.Origin(), b.Origin()) || a.Points().size() != b.Points().size() || a.Normals().size() != b.Normals().size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.Points().size(); i++) {
+			if (!same(a.Points()[i], b.Points()[i])) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.Normals().size(); i++) {
+			if (!same(a.Normals()[i], b.Normals()[i])) {
+				return false;
+			}
+		}
+		return a.Triangles() == b.Triangles() && a.Surfaces() == b.Surfaces();
+	}
+
+	void ModelTest_FloatOrigin() {
+		using FloatModel = LibModel<float>;
+		MY_ASSERT_EQ(sizeof(LibPoint<double>), 2 * sizeof(LibPoint<float>));
+
+		// far from the zero origin a float has a step of 0.25, around the box centre it keeps 1e-7
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		std::vector<Pt> far;
+		for (const Pt& pt : cylinder.Points()) {
+			far.push_back(pt + Vec(1e6, 2e6, -3e6));
+		}
+		cylinder.SetPoints(far);
+		Pt centre = cylinder.BoundingBox().Center();
+		FloatModel local = FloatModel::Recentered(cylinder, centre);
+		MY_ASSERT_VEC_EQ(centre.AsVector(), local.Origin());
+		MY_ASSERT_EQ(cylinder.TrinaglesNum(), local.TrinaglesNum());
+		MY_ASSERT_EQ(cylinder.Surfaces().size(), local.Surfaces().size());
+		for (size_t i = 0; i < cylinder.Points().size(); i++) {
+			MY_ASSERT_TRUE(cylinder.Points()[i].IsEqual(local.ToWorld(local.Points()[i]), 1e-5));
+		}
+
+		Ray ray(Pt(1e6 + 3, 2e6 + 0.2, -3e6 + 1.3), Vec(-1, 0.1, -0.2));
+		LibHit<double> exp, hit;
+		LibCancelToken token;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, 0, std::numeric_limits<double>::max(), exp));
+		for (int i = 0; i < 2; i++) {
+			if (i == 1) {
+				local.BuildBVH();
+			}
+			MY_ASSERT_TRUE(local.PickWorld(ray, 0, std::numeric_limits<double>::max(), hit, token));
+			MY_ASSERT_EQ(exp.m_trngl, hit.m_trngl);
+			MY_ASSERT_EQ(exp.m_srfc, hit.m_srfc);
+			MY_ASSERT_TRUE(exp.m_pt.IsEqual(hit.m_pt, 1e-5));
+
+			// the point is on the stored triangle to double precision
+			Pt A = local.ToWorld(local.GetPtInTrngl(hit.m_trngl, 0));
+			Pt B = local.ToWorld(local.GetPtInTrngl(hit.m_trngl, 1));
+			Pt C = local.ToWorld(local.GetPtInTrngl(hit.m_trngl, 2));
+			MY_ASSERT_TRUE(hit.m_pt.IsEqual(A + hit.m_u * (B - A) + hit.m_v * (C - A), 1e-8));
+		}
+
+		std::stringstream stream;
+		local.Save(stream);
+		FloatModel local2;
+		local2.Load(stream);
+		MY_ASSERT_TRUE(local2.Accel() != nullptr);
+
+		// copies keep the origin, a vertex is at the same world point in all of them
+		FloatModel local3;
+		local3.SetModel(local2);
+		for (const FloatModel* mdl : { &local2, &local3 }) {
+			MY_ASSERT_TRUE(SameBits(local, *mdl));
+		}
+		for (const FloatModel* mdl : { &local, &local2, &local3 }) {
+			MY_ASSERT_TRUE(cylinder.Points()[5].IsEqual(mdl->ToWorld(mdl->Points()[5]), 1e-5));
+		}
+	}
+
+	template<unsigned Bits>
+	void CheckQuantized(const Model& mdl, double maxErr) {
+		LibQuantizedModel<double, Bits> quant(mdl);
+		MY_ASSERT_EQ(mdl.TrinaglesNum(), quant.TrinaglesNum());
+		MY_ASSERT_TRUE(quant.MemorySize() < mdl.Points().size() * sizeof(Pt) + mdl.Triangles().size() * sizeof(Model::Index));
+		for (size_t i = 0; i < quant.TrinaglesNum(); i++) {
+			for (size_t k = 0; k < 3; k++) {
+				MY_ASSERT_EQ(mdl.GetPointIndex(i, k), quant.GlobalVertex(quant.GetVertex(i, k)));
+				MY_ASSERT_TRUE(mdl.GetPtInTrngl(i, k).IsEqual(quant.DecodeInTrngl(i, k), maxErr));
+			}
+		}
+
+		auto exact = [&mdl](size_t vtx) { return mdl.Points()[vtx]; };
+		for (int i = 0; i < 100; i++) {
+			Pt target(-0.9 + 0.18 * (i % 10), -0.9 + 0.18 * (i / 10), 0.1 + 0.017 * i);
+			Pt origin(3 - 0.06 * i, 2.5 - 0.05 * (i % 7), 5);
+			Ray ray(origin, target - origin);
+			LibHit<double> exp, hit;
+			bool isHit = mdl.IsIntersectionRay(ray, 0, std::numeric_limits<double>::max(), exp);
+			MY_ASSERT_EQ(isHit, quant.IsIntersectionRay(ray, 0, std::numeric_limits<double>::max(), hit));
+			if (!isHit) {
+				continue;
+			}
+			MY_ASSERT_TRUE(exp.m_pt.IsEqual(hit.m_pt, 10 * maxErr));
+
+			MY_ASSERT_TRUE(quant.Pick(ray, 0, std::numeric_limits<double>::max(), hit, exact));
+			MY_ASSERT_EQ(exp.m_trngl, hit.m_trngl);
+			MY_ASSERT_EQ(exp.m_srfc, hit.m_srfc);
+			MY_ASSERT_DOUBLE_EQ(exp.m_dist, hit.m_dist);
+		}
+	}
+
+	void ModelTest_Quantized() {
+		// boxes of the surfaces are 2 wide, a decoded point is within half a step of 2 / 65535 per axis
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		CheckQuantized<16>(cylinder, 3e-5);
+		CheckQuantized<21>(cylinder, 1e-6);
+
+		// triangles of no surface are quantized in ranges of their own
+		Model noSurfaces(cylinder.Points(), cylinder.Normals(), cylinder.Triangles(), { Model::Surface(1, 5) });
+		LibQuantizedModel<double> quant(noSurfaces);
+		MY_ASSERT_EQ(3, quant.Surfaces().size());
+		MY_ASSERT_EQ(-1, quant.Surfaces()[0].m_srfc);
+		MY_ASSERT_EQ(0, quant.Surfaces()[1].m_srfc);
+		MY_ASSERT_EQ(cylinder.TrinaglesNum(), quant.Surfaces()[2].m_lastTrngl);
+
+		// built from a saved file, exact positions are read back from it
+		std::stringstream stream;
+		cylinder.Save(stream);
+		LibQuantizedModel<double> loaded;
+		MY_ASSERT_TRUE(loaded.Load(stream));
+		LibQuantizedModel<double> built(cylinder);
+		MY_ASSERT_EQ(built.TrinaglesNum(), loaded.TrinaglesNum());
+		MY_ASSERT_EQ(built.MemorySize(), loaded.MemorySize());
+		for (size_t i = 0; i < loaded.TrinaglesNum(); i++) {
+			for (size_t k = 0; k < 3; k++) {
+				MY_ASSERT_EQ(built.GetVertex(i, k), loaded.GetVertex(i, k));
+				MY_ASSERT_EQ(built.DecodeInTrngl(i, k), loaded.DecodeInTrngl(i, k));
+			}
+		}
+		Ray ray(Pt(3, 0.2, 0.7), Vec(-1, 0, 0.1));
+		LibHit<double> exp, hit;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, 0, std::numeric_limits<double>::max(), exp));
+		MY_ASSERT_TRUE(loaded.Pick(ray, 0, std::numeric_limits<double>::max(), hit,
+			[&](size_t vtx) { return loaded.LoadPoint(stream, vtx); }));
+		MY_ASSERT_EQ(exp.m_trngl, hit.m_trngl);
+		MY_ASSERT_DOUBLE_EQ(exp.m_dist, hit.m_dist);
+
+		std::stringstream truncated(stream.str().substr(0, stream.str().size() / 2));
+		MY_ASSERT_FALSE(loaded.Load(truncated));
+		MY_ASSERT_EQ(0, loaded.TrinaglesNum());
+	}
+
+	void ModelTest_SoALayout() {
+		TP tp(4);
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		MY_ASSERT_EQ(0, cylinder.PointsSoA().Size());
+		LibAABB<double> expBox = cylinder.BoundingBox();
+
+		cylinder.SetLayout(Model::Layout::SoA);
+		const LibCoordArray<double>& pts = cylinder.PointsSoA();
+		MY_ASSERT_EQ(cylinder.Points().size(), pts.Size());
+		MY_ASSERT_EQ(0, reinterpret_cast<uintptr_t>(pts.X()) % LibCoordArray<double>::Align);
+		for (size_t i = 0; i < pts.Size(); i++) {
+			MY_ASSERT_VEC_EQ(cylinder.Points()[i], pts.Point(i));
+		}
+
+		LibAABB<double> box = cylinder.BoundingBox();
+		MY_ASSERT_VEC_EQ(expBox.Min(), box.Min());
+		MY_ASSERT_VEC_EQ(expBox.Max(), box.Max());
+		box = cylinder.BoundingBox(tp);
+		MY_ASSERT_VEC_EQ(expBox.Min(), box.Min());
+		MY_ASSERT_VEC_EQ(expBox.Max(), box.Max());
+
+		// unaligned ends around whole packs
+		for (size_t first : { 0, 1, 3, 5 }) {
+			for (size_t last : { first + 2, first + 7, pts.Size() - 1 }) {
+				LibAABB<double> exp;
+				for (size_t i = first; i < last; i++) {
+					exp.Extend(cylinder.Points()[i]);
+				}
+				box = pts.BoundingBox(first, last);
+				MY_ASSERT_VEC_EQ(exp.Min(), box.Min());
+				MY_ASSERT_VEC_EQ(exp.Max(), box.Max());
+			}
+		}
+
+		// normals written in place follow
+		cylinder.ComputeNormals(tp);
+		MY_ASSERT_EQ(cylinder.Normals().size(), cylinder.NormalsSoA().Size());
+		MY_ASSERT_VEC_EQ(cylinder.Normals()[0], cylinder.NormalsSoA().Vector(0));
+
+		cylinder.SetLayout(Model::Layout::AoS);
+		MY_ASSERT_EQ(0, cylinder.PointsSoA().Size());
+		MY_ASSERT_EQ(0, cylinder.NormalsSoA().Size());
+	}
+
+	void QueueTest_MPMC() {
+		LibMPMCQueue<int> queue(5);
+		MY_ASSERT_EQ(8, queue.Capacity());
+		int val = 0;
+		MY_ASSERT_FALSE(queue.TryPop(val));
+		for (int i = 0; i < 8; i++) {
+			MY_ASSERT_TRUE(queue.TryPush(i));
+		}
+		MY_ASSERT_FALSE(queue.TryPush(8));
+		for (int i = 0; i < 8; i++) {
+			MY_ASSERT_TRUE(queue.TryPop(val));
+			MY_ASSERT_EQ(i, val);
+		}
+		MY_ASSERT_FALSE(queue.TryPop(val));
+
+		MY_ASSERT_EQ(TransferThroughQueue<LibMPMCQueue<uint64_t>>(4, 4, 50000, "Benchmark MPMC queue 4 to 4"),
+			TransferThroughQueue<MutexQueue<uint64_t>>(4, 4, 50000, "Benchmark mutex queue 4 to 4"));
+		MY_ASSERT_EQ(TransferThroughQueue<LibMPMCQueue<uint64_t>>(1, 4, 200000, "Benchmark MPMC queue 1 to 4"),
+			TransferThroughQueue<MutexQueue<uint64_t>>(1, 4, 200000, "Benchmark mutex queue 1 to 4"));
+	}
+
+	// every producer pushes values 1..count, returns the sum popped by the consumers
+	template<typename Queue>
+	uint64_t TransferThroughQueue(size_t producers, size_t consumers, uint64_t count, [[maybe_unused]] const std::string& name) {
+		Queue queue(1024);
+		std::atomic<uint64_t> sum = 0;
+		std::atomic<uint64_t> left = producers * count;
+		std::vector<std::thread> threads;
+
+		TIMER_START(name);
+		for (size_t i = 0; i < consumers; i++) {
+			threads.emplace_back([&]() {
+				uint64_t val, local = 0;
+				while (left > 0) {
+					if (queue.TryPop(val)) {
+						local += val;
+						left--;
+					}
+					else {
+						std::this_thread::yield();
+					}
+				}
+				sum += local;
+			});
+		}
+		for (size_t i = 0; i < producers; i++) {
+			threads.emplace_back([&]() {
+				for (uint64_t val = 1; val <= count; val++) {
+					while (!queue.TryPush(val)) {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		TIMER_END(name);
+
+		MY_ASSERT_EQ(producers * count * (count + 1) / 2, sum.load());
+		return sum;
+	}
+
+	void ModelTest_PickService() {
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-4);
+		Ray ray = Ray(Pt(1.5, -1.5, 2.7), Vec(-3, 3, -1.7));
+		const double tMax = std::numeric_limits<double>::max();
+
+		LibHit<double> expHit;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, 0, tMax, expHit));
+
+		LibCancelToken token;
+		token.Cancel();
+		LibHit<double> hit;
+		MY_ASSERT_FALSE(cylinder.IsIntersectionRay(ray, 0, tMax, hit, token));
+		MY_ASSERT_FALSE(hit.m_isHit);
+
+		// accelerators poll the token while they walk
+		for (int i = 0; i < 2; i++) {
+			Model accelerated = cylinder;
+			if (i == 0) {
+				accelerated.BuildBVH();
+			}
+			else {
+				accelerated.BuildGrid();
+			}
+			double dist;
+			size_t ind;
+			MY_ASSERT_TRUE(accelerated.Accel()->IsIntersectionRay(accelerated, ray, 0, tMax, dist, ind));
+			MY_ASSERT_EQ(expHit.m_trngl, ind);
+			MY_ASSERT_FALSE(accelerated.Accel()->IsIntersectionRay(accelerated, ray, 0, tMax, dist, ind, &token));
+		}
+
+		TP tp(1);
+		std::mutex mtx;
+		std::vector<std::pair<uint64_t, LibHit<double>>> results;
+		auto onResult = [&](const LibHit<double>& res, uint64_t generation) {
+			std::lock_guard<std::mutex> lock(mtx);
+			results.push_back({ generation, res });
+		};
+
+		{
+			// the only worker is held, so the request is still queued when it gets cancelled
+			LibPickService<double> picker(std::make_shared<const Model>(cylinder), tp);
+			std::promise<void> gate;
+			std::future<void> held = tp.Submit([isOpen = gate.get_future().share()]() { isOpen.wait(); });
+			uint64_t generation = picker.Request(ray, 0, tMax, onResult);
+			MY_ASSERT_TRUE(picker.IsLatest(generation));
+			picker.Cancel();
+			MY_ASSERT_FALSE(picker.IsLatest(generation));
+			gate.set_value();
+			held.get();
+			picker.Wait();
+			MY_ASSERT_TRUE(results.empty());
+
+			// a burst of hover moves, only the newest request may report last
+			uint64_t last = 0;
+			for (int i = 0; i < 50; i++) {
+				Ray hover(Pt(1.5, -1.5, 2.7 - i * 0.01), Vec(-3, 3, -1.7));
+				last = picker.Request(i == 49 ? ray : hover, 0, tMax, onResult);
+			}
+			picker.Wait();
+			MY_ASSERT_FALSE(results.empty());
+			MY_ASSERT_EQ(last, results.back().first);
+			MY_ASSERT_TRUE(results.back().second.m_isHit);
+			MY_ASSERT_EQ(expHit.m_trngl, results.back().second.m_trngl);
+			MY_ASSERT_EQ(expHit.m_srfc, results.back().second.m_srfc);
+		}
+
+		{
+			// a queued query keeps its model alive after the service moved on to another one
+			std::shared_ptr<const Model> shared = std::make_shared<const Model>(cylinder);
+			std::weak_ptr<const Model> weak = shared;
+			LibPickService<double> picker(std::move(shared), tp);
+			std::promise<void> gate;
+			std::future<void> held = tp.Submit([isOpen = gate.get_future().share()]() { isOpen.wait(); });
+			picker.Request(ray, 0, tMax, onResult);
+			picker.SetModel(std::make_shared<const Model>());
+			MY_ASSERT_FALSE(weak.expired());
+			gate.set_value();
+			held.get();
+			picker.Wait();
+
+			results.clear();
+			uint64_t generation = picker.Request(ray, 0, tMax, onResult);
+			picker.Wait();
+			MY_ASSERT_EQ(1, results.size());
+			MY_ASSERT_EQ(generation, results.back().first);
+			MY_ASSERT_FALSE(results.back().second.m_isHit);
+		}
+	}
+
+	void ThreadPoolTest_GroupException() {
+		TP tp(2);
+		std::atomic<int> count = 0;
+		{
+			LibTaskGroup group(tp);
+			for (int i = 0; i < 8; i++) {
+				group.Run([&count, i]() {
+					count++;
+					if (i == 3) {
+						throw std::bad_alloc();
+					}
+				});
+			}
+			bool isThrown = false;
+			try {
+				group.Wait();
+			}
+			catch (const std::bad_alloc&) {
+				isThrown = true;
+			}
+			MY_ASSERT_TRUE(isThrown);
+			MY_ASSERT_EQ(8, count);
+			group.Wait();
+		}
+
+		// a chunk of a nested loop throws on a worker, the caller of the outer loop gets it
+		bool isThrown = false;
+		try {
+			LibParallel::For(tp, 0, 4, 1, [&tp](size_t first, size_t) {
+				LibParallel::For(tp, 0, 4, 1, [first](size_t inner, size_t) {
+					if (first == 2 && inner == 1) {
+						throw std::runtime_error("chunk");
+					}
+				});
+			});
+		}
+		catch (const std::runtime_error&) {
+			isThrown = true;
+		}
+		MY_ASSERT_TRUE(isThrown);
+		MY_ASSERT_EQ(0, tp.Submit([]() { return 0; }).get());
+	}
+
+	void ThreadPoolTest_InlineTasks() {
+		TP tp(2);
+		std::atomic<int> count = 0;
+		LibTaskGroup group(tp);
+
+		// array and aligned allocations are counted as well
+		size_t before = g_allocCount;
+		int* volatile arr = new int[4];
+		delete[] arr;
+		LibAlignedAllocator<double, 32> aligned;
+		aligned.deallocate(aligned.allocate(4), 4);
+		MY_ASSERT_EQ(before + 2, g_allocCount);
+
+		// the same burst twice, nothing is allocated per task once the pool is running
+		for (int round = 0; round < 2; round++) {
+			size_t allocs = g_allocCount;
+			for (int i = 0; i < 500; i++) {
+				group.Run([&count, i]() { count += i; });
+			}
+			group.Wait();
+			MY_ASSERT_EQ(allocs, g_allocCount);
+		}
+		MY_ASSERT_EQ(2 * 499 * 500 / 2, count);
+
+		// a burst larger than the arena spills to the heap and still runs every task
+		count = 0;
+		for (int i = 0; i < 5000; i++) {
+			group.Run([&count]() { count++; });
+		}
+		group.Wait();
+		MY_ASSERT_EQ(5000, count);
+
+		// callables too large for a slot take the heap path
+		std::array<double, 32> big{};
+		big[31] = 1.5;
+		std::promise<double> res;
+		tp.Post([big, &res]() { res.set_value(big[31]); });
+		MY_ASSERT_DOUBLE_EQ(1.5, res.get_future().get());
+	}
+
+	void ThreadPoolTest_Placement() {
+		std::vector<LibAffinity::Core> cores = LibAffinity::Cores();
+		MY_ASSERT_FALSE(cores.empty());
+		for (size_t i = 1; i < cores.size(); i++) {
+			MY_ASSERT_TRUE(cores[i - 1].m_id < cores[i].m_id);
+		}
+
+		LibPoolOptions options;
+		options.threadsNum = 4;
+		options.pinThreads = true;
+		options.groupByNode = true;
+		TP tp(options);
+		MY_ASSERT_TRUE(tp.IsPlaced());
+		MY_ASSERT_FALSE(TP(2).IsPlaced());
+		for (size_t i = 1; i < tp.ThreadsNum(); i++) {
+			MY_ASSERT_TRUE(tp.WorkerNode(i - 1) <= tp.WorkerNode(i));
+		}
+
+		std::atomic<size_t> sum = 0;
+		LibParallel::ForEach(tp, 0, 10000, 100, [&sum](size_t i) { sum += i; });
+		MY_ASSERT_EQ(size_t(9999 * 10000 / 2), sum);
+
+		// the cache filled by the workers matches the serial one, padding lanes included
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		LibTrnglCache<double> serial, placed;
+		serial.Build(cylinder.Points(), cylinder.Triangles());
+		placed.Build(cylinder.Points(), cylinder.Triangles(), tp, 7);
+		MY_ASSERT_EQ(serial.TrinaglesNum(), placed.TrinaglesNum());
+		MY_ASSERT_EQ(serial.Blocks().size(), placed.Blocks().size());
+		for (size_t i = 0; i < serial.Blocks().size(); i++) {
+			const LibTrnglCache<double>::Block& a = serial.Blocks()[i];
+			const LibTrnglCache<double>::Block& b = placed.Blocks()[i];
+			MY_ASSERT_EQ(0, std::memcmp(a.m_v0, b.m_v0, sizeof(a.m_v0)));
+			MY_ASSERT_EQ(0, std::memcmp(a.m_e1, b.m_e1, sizeof(a.m_e1)));
+			MY_ASSERT_EQ(0, std::memcmp(a.m_e2, b.m_e2, sizeof(a.m_e2)));
+		}
+
+		Ray ray = Ray(Pt(1.5, -1.5, 2.7), Vec(-3, 3, -1.7));
+		Pt pt, pt2; int srfc, srfc2;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRayTP(ray, pt, srfc, tp));
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt2, srfc2));
+		MY_ASSERT_EQ(pt2, pt);
+		MY_ASSERT_EQ(srfc2, srfc);
+	}
+
+	void ThreadPoolTest_Priority() {
+		TP tp(1);
+		std::promise<void> gate;
+		std::future<void> held = tp.Submit([isOpen = gate.get_future().share()]() { isOpen.wait(); });
+
+		std::mutex mtx;
+		std::vector<LibPriority> order;
+		auto record = [&]() {
+			std::lock_guard<std::mutex> lock(mtx);
+			order.push_back(TP::CurrentPriority());
+		};
+
+		// the worker is held while both lanes fill, then interactive work goes first
+		std::future<LibPriority> nested;
+		{
+			LibTaskGroup background(tp, LibPriority::Background);
+			LibTaskGroup interactive(tp);
+			background.Run([&]() { nested = tp.Submit([]() { return TP::CurrentPriority(); }); });
+			for (int i = 0; i < 100; i++) {
+				background.Run(record);
+			}
+			for (int i = 0; i < 5; i++) {
+				interactive.Run(record);
+			}
+			gate.set_value();
+			held.get();
+			interactive.Wait();
+			background.Wait();
+		}
+		MY_ASSERT_EQ(size_t(105), order.size());
+		for (size_t i = 0; i < order.size(); i++) {
+			MY_ASSERT_TRUE(order[i] == (i < 5 ? LibPriority::Interactive : LibPriority::Background));
+		}
+		MY_ASSERT_TRUE(nested.get() == LibPriority::Background);
+
+		// background loops are cut into grain sized chunks
+		std::atomic<int> chunks = 0;
+		LibParallel::For(tp, 0, 1000, 10, [&chunks](size_t, size_t) { chunks++; });
+		MY_ASSERT_EQ(4, chunks);
+		{
+			TP::PriorityScope scope(LibPriority::Background);
+			chunks = 0;
+			LibParallel::For(tp, 0, 1000, 10, [&chunks](size_t, size_t) { chunks++; });
+			MY_ASSERT_EQ(100, chunks);
+		}
+		MY_ASSERT_TRUE(TP::CurrentPriority() == LibPriority::Interactive);
+
+		// an interactive task posted while a long background loop runs on the only worker waits for the
+		// current chunk, a quarter of the loop would be done if it waited for one of four chunks per worker
+		std::atomic<int> done = 0;
+		std::atomic<bool> isStarted = false;
+		std::promise<void> started;
+		LibTaskGroup loop(tp, LibPriority::Background);
+		loop.Run([&]() {
+			LibParallel::For(tp, 0, 200, 1, [&](size_t first, size_t last) {
+				if (!isStarted.exchange(true)) {
+					started.set_value();
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(last - first));
+				done += static_cast<int>(last - first);
+			});
+		});
+		started.get_future().wait();
+		int doneBefore = tp.Submit([&done]() { return done.load(); }).get();
+		MY_ASSERT_TRUE(doneBefore < 50);
+		loop.Wait();
+		MY_ASSERT_EQ(200, done);
+
+		// an interactive task waiting for interactive work helps with that lane only
+		TP tp2(2);
+		std::promise<void> gate2;
+		std::shared_future<void> isOpen2 = gate2.get_future().share();
+		std::atomic<bool> waiting = false;
+		std::atomic<int> helped = 0;
+		std::promise<std::thread::id> waiter;
+		std::future<std::thread::id> waiterId = waiter.get_future();
+		std::promise<void> waited;
+		tp2.PostTo(0, LibPriority::Interactive, [&]() {
+			waiter.set_value(std::this_thread::get_id());
+			std::promise<void> started;
+			LibTaskGroup group(tp2);
+			group.RunOn(1, [&started, isOpen2]() {
+				started.set_value();
+				isOpen2.wait();
+			});
+			started.get_future().wait();
+			for (int i = 0; i < 20; i++) {
+				tp2.Post(LibPriority::Background, [&, id = std::this_thread::get_id()]() {
+					if (waiting && std::this_thread::get_id() == id) {
+						helped++;
+					}
+				});
+			}
+			waiting = true;
+			group.Wait();
+			waiting = false;
+			waited.set_value();
+		});
+		waiterId.wait();
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		gate2.set_value();
+		waited.get_future().wait();
+		tp2.WaitForFinish();
+		MY_ASSERT_EQ(0, helped);
+	}
+
+	void ThreadPoolTest_NestedForkJoin() {
+		// a single worker would deadlock if a waiting task blocked it
+		for (size_t threads : { 1, 4 }) {
+			TP tp(threads);
+			const long long count = 1000000;
+			MY_ASSERT_EQ(count * (count - 1) / 2, tp.Submit([&tp]() { return ForkSum(tp, 0, count); }).get());
+
+			std::atomic<int> visits = 0;
+			tp.Submit([&]() {
+				LibParallel::ForEach(tp, 0, 10000, 100, [&visits](size_t) { visits++; });
+			}).get();
+			MY_ASSERT_EQ(10000, visits);
+
+			std::atomic<int> done = 0;
+			tp.Submit([&]() {
+				for (int i = 0; i < 20; i++) {
+					tp.AddTask(std::make_unique<CountTask>(done, 100));
+				}
+				tp.WaitForFinish();
+			}).get();
+			MY_ASSERT_EQ(20, done);
+		}
+
+		// the SAH tree built by fork-join is the one of the serial build
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+		std::shared_ptr<LibBVH<double>> serial = std::make_shared<LibBVH<double>>();
+		serial->Build(cylinder.Points(), cylinder.Triangles());
+		TP tp(4);
+		std::shared_ptr<LibBVH<double>> forked = std::make_shared<LibBVH<double>>();
+		forked->Build(cylinder.Points(), cylinder.Triangles(), tp);
+		MY_ASSERT_EQ(serial->Nodes().size(), forked->Nodes().size());
+		MY_ASSERT_TRUE(serial->Indices() == forked->Indices());
+		cylinder.SetAccel(forked);
+		CompareAccelWithBruteForce(cylinder);
+	}
+
+	void AsyncTest_Pipeline() {
+		TP tp(2);
+		MY_ASSERT_EQ(49, AsyncSquare(tp, 7).Get());
+
+		// the stages run at once, the awaiter gets every result
+		std::vector<int> squares(3, 0);
+		auto sum = [](TP& tp, std::vector<int>& squares) -> LibAsyncTask<int> {
+			std::vector<LibAsyncTask<void>> stages;
+			for (int i = 0; i < 3; i++) {
+				stages.push_back([](TP& tp, int& res, int val) -> LibAsyncTask<void> {
+					res = co_await AsyncSquare(tp, val);
+				}(tp, squares[i], i + 2));
+			}
+			co_await LibAsync::WhenAll(tp, std::move(stages));
+			co_return squares[0] + squares[1] + squares[2];
+		};
+		MY_ASSERT_EQ(4 + 9 + 16, sum(tp, squares).Get());
+
+		auto fail = [](TP& tp) -> LibAsyncTask<void> {
+			std::vector<LibAsyncTask<void>> stages;
+			stages.push_back([](TP& tp) -> LibAsyncTask<void> {
+				co_await LibAsync::ResumeOn(tp);
+				throw std::runtime_error("stage failed");
+			}(tp));
+			co_await LibAsync::WhenAll(tp, std::move(stages));
+		};
+		bool isThrown = false;
+		try {
+			fail(tp).Get();
+		}
+		catch (const std::runtime_error&) {
+			isThrown = true;
+		}
+		MY_ASSERT_TRUE(isThrown);
+
+		// the pipeline ends on the thread running the event queue
+		EventQueue events;
+		std::shared_ptr<Model> mdl;
+		std::thread::id installThread;
+		std::atomic<bool> isDone = false;
+		AsyncLoad(tp, events, mdl, installThread, isDone).Detach();
+		events.RunUntil(isDone);
+		MY_ASSERT_TRUE(installThread == std::this_thread::get_id());
+		MY_ASSERT_TRUE(mdl && mdl->Accel() != nullptr);
+		MY_ASSERT_EQ(mdl->Points().size(), mdl->Normals().size());
+
+		// a pool destroyed while a coroutine waits in its queue resumes it, the frame and what it holds
+		// are freed
+		std::weak_ptr<Model> held;
+		std::atomic<int> ran = 0;
+		{
+			TP tp1(1);
+			std::promise<void> gate;
+			tp1.Post([isOpen = gate.get_future().share()]() { isOpen.wait(); });
+			auto hold = [](TP& tp, std::shared_ptr<Model> mdl, std::atomic<int>& ran) -> LibAsyncTask<void> {
+				co_await LibAsync::ResumeOn(tp);
+				ran++;
+			};
+			std::shared_ptr<Model> cube = std::make_shared<Model>(Model::CreateCube(Pt(0, 0, 0), 1));
+			held = cube;
+			hold(tp1, std::move(cube), ran).Detach();
+			for (int i = 0; i < 10; i++) {
+				tp1.Post([&tp1, &ran]() { tp1.Post([&ran]() { ran++; }); });
+			}
+			gate.set_value();
+		}
+		MY_ASSERT_EQ(11, ran);
+		MY_ASSERT_TRUE(held.expired());
+	}
+
+	// tiny tasks measure the scheduling overhead, the pick splits one ray into about 100 chunks
+	void ThreadPoolTest_Benchmark() {
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-5);
+		Ray ray = Ray(Pt(1.5, -1.5, 2.7), Vec(-3, 3, -1.7));
+		Pt expPt; int expSrfc;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, expPt, expSrfc));
+
+		size_t maxThreads = std::max<size_t>(4, std::thread::hardware_concurrency());
+		for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+			TP tp(threads);
+			std::atomic<int> count = 0;
+			std::string name = "Benchmark 100000 tasks on " + std::to_string(threads) + " threads";
+			TIMER_START(name);
+			for (int i = 0; i < 100000; i++) {
+				tp.AddTask(std::make_unique<CountTask>(count, 20));
+			}
+			tp.WaitForFinish();
+			TIMER_END(name);
+			MY_ASSERT_EQ(100000, count);
+
+			Pt pt; int srfc;
+			name = "Benchmark pick with threadPool on " + std::to_string(threads) + " threads";
+			for (int i = 0; i < 20; i++) {
+				TIMER_START(name);
+				MY_ASSERT_TRUE(cylinder.IsIntersectionRayTP(ray, pt, srfc, tp));
+				TIMER_END(name);
+			}
+			MY_ASSERT_EQ(expPt, pt);
+			MY_ASSERT_EQ(expSrfc, srfc);
+		}
+	}
+
+	void ModelTest_SaveAccel() {
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		Model cube = Model::CreateCube(Pt(0.5, 0.5, 0.5), 1.0);
+		Ray ray(Pt(3, 0.2, 1.3), Vec(-1, 0.1, -0.2));
+
+		for (int i = 0; i < 2; i++) {
+			if (i == 0) {
+				cylinder.BuildBVH();
+			}
+			else {
+				cylinder.BuildGrid();
+			}
+
+			std::stringstream stream;
+			cube.Save(stream);
+			cylinder.Save(stream);
+
+			Model cube2, cylinder2;
+			cube2.Load(stream);
+			cylinder2.Load(stream);
+			MY_ASSERT_TRUE(cube2.Accel() == nullptr);
+			MY_ASSERT_TRUE(cube.Triangles() == cube2.Triangles());
+			MY_ASSERT_TRUE(cylinder2.Accel() != nullptr);
+			MY_ASSERT_TRUE(cylinder.Accel()->GetType() == cylinder2.Accel()->GetType());
+			MY_ASSERT_EQ(cylinder.GeometryHash(), cylinder2.GeometryHash());
+
+			Pt pt, pt2; int srfc, srfc2;
+			MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt, srfc, *cylinder.Accel()));
+			MY_ASSERT_TRUE(cylinder2.IsIntersectionRay(ray, pt2, srfc2, *cylinder2.Accel()));
+			MY_ASSERT_VEC_EQ(pt, pt2);
+			MY_ASSERT_EQ(srfc, srfc2);
+		}
+
+		std::stringstream stream;
+		cylinder.Save(stream);
+		std::string data = stream.str();
+		data[sizeof(size_t)] ^= 1;
+		std::stringstream changed(data);
+		Model cylinder3;
+		cylinder3.Load(changed);
+		MY_ASSERT_TRUE(cylinder3.Accel() == nullptr);
+		MY_ASSERT_EQ(cylinder.TrinaglesNum(), cylinder3.TrinaglesNum());
+	}
+
+	void ModelTest_IndexWidth() {
+		using WideModel = LibModel<double, size_t>;
+		MY_ASSERT_EQ(sizeof(uint32_t), sizeof(Model::Index));
+
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		WideModel wide = WideModel::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-3);
+		MY_ASSERT_TRUE(std::equal(cylinder.Triangles().begin(), cylinder.Triangles().end(),
+			wide.Triangles().begin(), wide.Triangles().end()));
+		MY_ASSERT_EQ(cylinder.GeometryHash(), wide.GeometryHash());
+
+		// the file does not depend on the index width, the saved accelerator is reused
+		cylinder.BuildBVH();
+		std::stringstream stream;
+		cylinder.Save(stream);
+		WideModel wide2;
+		MY_ASSERT_TRUE(wide2.Load(stream));
+		MY_ASSERT_TRUE(wide2.Accel() != nullptr);
+
+		Ray ray(Pt(3, 0.2, 1.3), Vec(-1, 0.1, -0.2));
+		Pt pt, pt2; int srfc, srfc2;
+		MY_ASSERT_TRUE(cylinder.IsIntersectionRay(ray, pt, srfc, *cylinder.Accel()));
+		MY_ASSERT_TRUE(wide2.IsIntersectionRay(ray, pt2, srfc2, *wide2.Accel()));
+		MY_ASSERT_VEC_EQ(pt, pt2);
+		MY_ASSERT_EQ(srfc, srfc2);
+
+		// an index the narrow type can't hold fails the load
+		std::vector<Pt> pts(70000, Pt(0, 0, 0));
+		WideModel big(pts, {}, { 0, 1, 69999 }, { WideModel::Surface(0, 1) });
+		std::stringstream bigStream;
+		big.Save(bigStream);
+		LibModel<double, uint16_t> narrow;
+		MY_ASSERT_FALSE(narrow.Load(bigStream));
+		MY_ASSERT_TRUE(bigStream.fail());
+		MY_ASSERT_TRUE(narrow.TrinaglesNum() == 0);
+	}
+
+	void CompareAllHits(const Model& mdl, const std::vector<Ray>& rays,
+		const std::vector<std::vector<LibHit<double>>>& expHits) {
+		std::vector<LibHit<double>> hits;
+		hits.reserve(16);
+		const LibHit<double>* buffer = hits.data();
+		for (size_t i = 0; i < rays.size(); i++) {
+			MY_ASSERT_EQ(expHits[i].size(), mdl.IntersectAll(rays[i], hits));
+			for (size_t j = 0; j < hits.size(); j++) {
+				MY_ASSERT_EQ(expHits[i][j].m_trngl, hits[j].m_trngl);
+				MY_ASSERT_EQ(expHits[i][j].m_srfc, hits[j].m_srfc);
+				MY_ASSERT_DOUBLE_EQ(expHits[i][j].m_dist, hits[j].m_dist);
+			}
+		}
+		MY_ASSERT_TRUE(buffer == hits.data());
+	}
+
+	void CompareOcclusion(const Model& mdl, const std::vector<Ray>& rays, const std::vector<double>& tMax,
+		const std::vector<uint8_t>& expOccluded) {
+		std::vector<uint8_t> occluded(rays.size());
+		mdl.IsOccluded(rays, tMax, occluded);
+		MY_ASSERT_EQ(expOccluded, occluded);
+
+		for (size_t i = 0; i < rays.size(); i++) {
+			MY_ASSERT_EQ(expOccluded[i] == 1, mdl.IsOccluded(rays[i], tMax[i]));
+		}
+	}
+
+	void CompareHits(const Model& mdl, const std::vector<Ray>& rays, const std::vector<LibHit<double>>& expHits) {
+		std::vector<LibHit<double>> hits(rays.size());
+		mdl.IntersectRays(rays, hits);
+
+		int hitsCount = 0;
+		for (size_t i = 0; i < rays.size(); i++) {
+			MY_ASSERT_EQ(expHits[i].m_isHit, hits[i].m_isHit);
+			if (expHits[i].m_isHit) {
+				MY_ASSERT_EQ(expHits[i].m_pt, hits[i].m_pt);
+				MY_ASSERT_EQ(expHits[i].m_srfc, hits[i].m_srfc);
+				hitsCount++;
+			}
+		}
+		MY_ASSERT_TRUE(hitsCount > 200);
+	}
+
+	void ModelTest_AccelBenchmark() {
+		Model cylinder = Model::CreateCylinder(Pt(0, 0, 0), Vec(0, 0, 1), 1, 2, 1e-6);
+		TP tp(std::thread::hardware_concurrency());
+
+		TIMER_START("Benchmark build SAH BVH");
+		cylinder.BuildBVH();
+		TIMER_END("Benchmark build SAH BVH");
+		BenchmarkAccel(cylinder, "Benchmark picking SAH BVH");
+		BenchmarkPackets(cylinder, "Benchmark packet picking SAH BVH");
+
+		TIMER_START("Benchmark build LBVH");
+		cylinder.BuildBVH(tp);
+		TIMER_END("Benchmark build LBVH");
+		BenchmarkAccel(cylinder, "Benchmark picking LBVH");
+
+		TIMER_START("Benchmark build uniform grid");
+		cylinder.BuildGrid();
+		TIMER_END("Benchmark build uniform grid");
+		BenchmarkAccel(cylinder, "Benchmark picking uniform grid");
+	}
+
+	void BenchmarkAccel(const Model& mdl, [[maybe_unused]] const std::string& name) {
+		Pt pt; int srfc;
+		for (int i = 0; i < 1000; i++) {
+			double angle = 2 * M_PI * i / 1000;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.003);
+			Ray ray(origin, Pt(0.3 * std::cos(angle * 3), 0.3 * std::sin(angle * 3), 1) - origin);
+
+			TIMER_START(name);
+			mdl.IsIntersectionRay(ray, pt, srfc, *mdl.Accel());
+			TIMER_END(name);
+		}
+	}
+
+	// the same 1000 rays as BenchmarkAccel, traced in one batch
+	void BenchmarkPackets(const Model& mdl, [[maybe_unused]] const std::string& name) {
+		std::vector<Ray> rays;
+		for (int i = 0; i < 1000; i++) {
+			double angle = 2 * M_PI * i / 1000;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.003);
+			rays.push_back(Ray(origin, Pt(0.3 * std::cos(angle * 3), 0.3 * std::sin(angle * 3), 1) - origin));
+		}
+
+		std::vector<LibHit<double>> hits(rays.size());
+		TIMER_START(name);
+		mdl.IntersectRays(rays, hits);
+		TIMER_END(name);
+	}
+
+	void CompareAccelWithBruteForce(const Model& mdl) {
+		int hits = 0;
+		for (int i = 0; i < 200; i++) {
+			double angle = 2 * M_PI * i / 200;
+			Pt origin(3 * std::cos(angle), 3 * std::sin(angle), 2.5 - i * 0.015);
+			Pt target(0.3 * std::cos(angle * 3), 0.3 * std::sin(angle * 3), 1 + std::sin(angle * 5));
+			Ray r(origin, i % 5 == 0 ? origin - target : target - origin);
+
+			Pt expPt; int expSrfc;
+			bool isExp = mdl.IsIntersectionRay(r, expPt, expSrfc);
+
+			Pt bvhPt; int bvhSrfc;
+			MY_ASSERT_EQ(isExp, mdl.IsIntersectionRay(r, bvhPt, bvhSrfc, *mdl.Accel()));
+			if (isExp) {
+				MY_ASSERT_EQ(expPt, bvhPt);
+				MY_ASSERT_EQ(expSrfc, bvhSrfc);
+				hits++;
+			}
+		}
+		MY_ASSERT_TRUE(hits > 100);
 	}
 
 public:
@@ -571,11 +2272,39 @@ public:
 		
 		RUN_TEST(TriangleTest_IsPointOnTrngl);
 		RUN_TEST(TriangleTest_IntersLine);
+		RUN_TEST(TriangleTest_MollerTrumbore);
 
 		RUN_TEST(ModelTest_CreateCube);
 		RUN_TEST(ModelTest_CreateCylinder);
 		RUN_TEST(ModelTest_CubeIntersRay);
 		RUN_TEST(ModelTest_CylinderIntersRay);
+		RUN_TEST(ModelTest_TrnglCache);
+		RUN_TEST(ModelTest_TrnglCacheConcurrent);
+		RUN_TEST(ModelTest_BVHIntersRay);
+		RUN_TEST(ModelTest_GridIntersRay);
+		RUN_TEST(ModelTest_IntersectRays);
+		RUN_TEST(ModelTest_Occlusion);
+		RUN_TEST(ModelTest_IntersectAll);
+		RUN_TEST(ModelTest_IntervalQuery);
+		RUN_TEST(ModelTest_SaveAccel);
+		RUN_TEST(ModelTest_IndexWidth);
+		RUN_TEST(QueueTest_MPMC);
+		RUN_TEST(ThreadPoolTest_WorkStealing);
+		RUN_TEST(ThreadPoolTest_TaskGroups);
+		RUN_TEST(ThreadPoolTest_GroupException);
+		RUN_TEST(ThreadPoolTest_InlineTasks);
+		RUN_TEST(ThreadPoolTest_Placement);
+		RUN_TEST(ThreadPoolTest_Priority);
+		RUN_TEST(ThreadPoolTest_NestedForkJoin);
+		RUN_TEST(AsyncTest_Pipeline);
+		RUN_TEST(ParallelTest_ForReduce);
+		RUN_TEST(ModelTest_ComputeNormals);
+		RUN_TEST(ModelTest_FloatOrigin);
+		RUN_TEST(ModelTest_SoALayout);
+		RUN_TEST(ModelTest_Quantized);
+		RUN_TEST(ModelTest_PickService);
+		RUN_TEST(ThreadPoolTest_Benchmark);
+		RUN_TEST(ModelTest_AccelBenchmark);
 		RUN_TEST(ModelTest_BigCylinder);
 	}
 
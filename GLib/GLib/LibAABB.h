@@ -0,0 +1,130 @@
+#pragma once
+
+#include <limits>
+#include <algorithm>
+#include "LibPoint.h"
+#include "LibVector.h"
+
+template<typename T>
+class LibAABB {
+public:
+	LibAABB() :
+		m_ptMin(std::numeric_limits<T>::max(), std::numeric_limits<T>::max(), std::numeric_limits<T>::max()),
+		m_ptMax(std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest()) {}
+
+	LibAABB(const LibPoint<T>& ptMin, const LibPoint<T>& ptMax) :
+		m_ptMin(ptMin), m_ptMax(ptMax) {}
+
+	~LibAABB() = default;
+
+	inline const LibPoint<T>& Min() const {
+		return m_ptMin;
+	}
+
+	inline const LibPoint<T>& Max() const {
+		return m_ptMax;
+	}
+
+	inline bool IsEmpty() const {
+		return m_ptMin.X() > m_ptMax.X();
+	}
+
+	LibAABB<T>& Extend(const LibPoint<T>& pt) {
+		m_ptMin.SetXYZ(std::min(m_ptMin.X(), pt.X()), std::min(m_ptMin.Y(), pt.Y()), std::min(m_ptMin.Z(), pt.Z()));
+		m_ptMax.SetXYZ(std::max(m_ptMax.X(), pt.X()), std::max(m_ptMax.Y(), pt.Y()), std::max(m_ptMax.Z(), pt.Z()));
+		return *this;
+	}
+
+	LibAABB<T>& Extend(const LibAABB<T>& box) {
+		if (!box.IsEmpty()) {
+			Extend(box.Min());
+			Extend(box.Max());
+		}
+		return *this;
+	}
+
+	LibAABB<T>& Inflate(T delta) {
+		m_ptMin.SetXYZ(m_ptMin.X() - delta, m_ptMin.Y() - delta, m_ptMin.Z() - delta);
+		m_ptMax.SetXYZ(m_ptMax.X() + delta, m_ptMax.Y() + delta, m_ptMax.Z() + delta);
+		return *this;
+	}
+
+	LibVector<T> Diagonal() const {
+		return m_ptMax - m_ptMin;
+	}
+
+	LibPoint<T> Center() const {
+		return m_ptMin + Diagonal() / 2;
+	}
+
+	T SurfaceArea() const {
+		if (IsEmpty()) {
+			return 0;
+		}
+		LibVector<T> diag = Diagonal();
+		return 2 * (diag.X() * diag.Y() + diag.Y() * diag.Z() + diag.Z() * diag.X());
+	}
+
+	int MaxAxis() const {
+		LibVector<T> diag = Diagonal();
+		if (diag.X() >= diag.Y() && diag.X() >= diag.Z()) {
+			return 0;
+		}
+		return diag.Y() >= diag.Z() ? 1 : 2;
+	}
+
+	// slab test, dirInv holds the reciprocal of the ray direction per axis
+	bool IsIntersectionRay(const LibPoint<T>& origin, const T* dirInv, T tMax, T& tNear) const {
+		T tFar;
+		return IsIntersectionRay(origin, dirInv, tMax, tNear, tFar);
+	}
+
+	bool IsIntersectionRay(const LibPoint<T>& origin, const T* dirInv, T tMax, T& tNear, T& tFar) const {
+		return IsIntersectionRay(origin, dirInv, 0, tMax, tNear, tFar);
+	}
+
+	// slab test clipped to [tMin, tMax]
+	bool IsIntersectionRay(const LibPoint<T>& origin, const T* dirInv, T tMin, T tMax, T& tNear, T& tFar) const {
+		for (size_t axis = 0; axis < 3; axis++) {
+			T t1 = (m_ptMin.At(axis) - origin.At(axis)) * dirInv[axis];
+			T t2 = (m_ptMax.At(axis) - origin.At(axis)) * dirInv[axis];
+			if (t1 > t2) {
+				std::swap(t1, t2);
+			}
+			tMin = std::max(tMin, t1);
+			tMax = std::min(tMax, t2);
+			if (tMin > tMax) {
+				return false;
+			}
+		}
+		tNear = tMin;
+		tFar = tMax;
+		return true;
+	}
+
+	static void GetDirInv(const LibVector<T>& dir, T* dirInv) {
+		for (size_t axis = 0; axis < 3; axis++) {
+			T val = dir.At(axis);
+			if (val == 0) {
+				dirInv[axis] = std::numeric_limits<T>::max();
+			}
+			else {
+				dirInv[axis] = 1 / val;
+			}
+		}
+	}
+
+	void Save(std::ostream& out) const {
+		m_ptMin.Save(out);
+		m_ptMax.Save(out);
+	}
+
+	void Load(std::istream& in) {
+		m_ptMin.Load(in);
+		m_ptMax.Load(in);
+	}
+
+private:
+	LibPoint<T> m_ptMin;
+	LibPoint<T> m_ptMax;
+};
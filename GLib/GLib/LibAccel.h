@@ -0,0 +1,75 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include "LibRay.h"
+#include "LibRayPacket.h"
+#include "LibHit.h"
+#include "LibCancelToken.h"
+
+template<typename T, typename I>
+class LibModel;
+
+// spatial index over the triangles of a model, answers closest hit queries for LibModel. I is the vertex
+// index type of the model
+template<typename T, typename I = uint32_t>
+class LibAccel {
+public:
+	// tag of the serialized accelerator, values are stored in model files and must not change
+	enum class Type : uint32_t {
+		BVH = 1,
+		Grid = 2
+	};
+
+	virtual ~LibAccel() = default;
+
+	virtual Type GetType() const = 0;
+
+	// raw dump of the built structure, only valid for the geometry it was built from
+	virtual void Save(std::ostream& out) const = 0;
+	virtual void Load(std::istream& in) = 0;
+
+	// closest hit in [tMin, tMax), dist is the distance along the normalized direction. A token is polled
+	// every m_CancelPoll nodes or cells, the query returns no hit once it is cancelled
+	virtual bool IsIntersectionRay(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMin, T tMax, T& dist, size_t& ind,
+		const LibCancelToken* token) const = 0;
+
+	bool IsIntersectionRay(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMin, T tMax, T& dist, size_t& ind) const {
+		return IsIntersectionRay(mdl, ray, tMin, tMax, dist, ind, nullptr);
+	}
+
+	bool IsIntersectionRay(const LibModel<T, I>& mdl, const LibRay<T>& ray, T& dist, size_t& ind) const {
+		return IsIntersectionRay(mdl, ray, 0, std::numeric_limits<T>::max(), dist, ind, nullptr);
+	}
+
+	// any hit in [0, tMax), may stop at the first triangle found
+	virtual bool IsOccluded(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMax) const = 0;
+
+	// appends every crossing with m_dist, m_trngl, m_u and m_v set, unordered and possibly repeated
+	virtual void IntersectAll(const LibModel<T, I>& mdl, const LibRay<T>& ray, std::vector<LibHit<T>>& hits) const = 0;
+
+	// closest hit per lane, dist stays max for lanes without a hit; by default the lanes are traced one by one
+	virtual void IsIntersectionPacket(const LibModel<T, I>& mdl, const LibRayPacket<T>& packet, T* dist, size_t* ind) const {
+		for (size_t lane = 0; lane < packet.Count(); lane++) {
+			if (!IsIntersectionRay(mdl, packet.Ray(lane), dist[lane], ind[lane])) {
+				dist[lane] = std::numeric_limits<T>::max();
+			}
+		}
+	}
+
+	// bit per occluded lane, tMax holds a bound per lane
+	virtual int IsOccludedPacket(const LibModel<T, I>& mdl, const LibRayPacket<T>& packet, const T* tMax) const {
+		int bits = 0;
+		for (size_t lane = 0; lane < packet.Count(); lane++) {
+			if (IsOccluded(mdl, packet.Ray(lane), tMax[lane])) {
+				bits |= 1 << lane;
+			}
+		}
+		return bits;
+	}
+
+protected:
+	static constexpr size_t m_CancelPoll = 64;
+};
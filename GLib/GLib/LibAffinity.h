@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <string>
+#include <algorithm>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#include <sstream>
+#endif
+
+// logical cores the process may run on, with the NUMA node of each, and binding of threads to them.
+// Without an affinity API every core is on node 0 and binding does nothing
+class LibAffinity {
+public:
+	struct Core {
+		size_t m_id;
+		size_t m_node;
+	};
+
+	// ordered by id
+	static std::vector<Core> Cores() {
+		std::vector<Core> cores;
+#if defined(_WIN32)
+		// RelationNumaNode reports the primary group of a node only, systems older than the Ex relation
+		// have one group per node and leave GroupCount zero
+		std::vector<char> buf;
+		DWORD size = 0;
+		for (LOGICAL_PROCESSOR_RELATIONSHIP relation : { RelationNumaNodeEx, RelationNumaNode }) {
+			size = 0;
+			GetLogicalProcessorInformationEx(relation, nullptr, &size);
+			buf.resize(size);
+			if (size > 0 && GetLogicalProcessorInformationEx(relation,
+				reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data()), &size)) {
+				break;
+			}
+			size = 0;
+		}
+		for (DWORD offset = 0; offset < size;) {
+			auto* info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buf.data() + offset);
+			const WORD groups = std::max<WORD>(info->NumaNode.GroupCount, 1);
+			for (WORD group = 0; group < groups; group++) {
+				const GROUP_AFFINITY& mask = info->NumaNode.GroupMasks[group];
+				for (size_t bit = 0; bit < m_GroupSize; bit++) {
+					if (mask.Mask & (KAFFINITY(1) << bit)) {
+						cores.push_back({ mask.Group * m_GroupSize + bit, info->NumaNode.NodeNumber });
+					}
+				}
+			}
+			offset += info->Size;
+		}
+#elif defined(__linux__)
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+			for (size_t id = 0; id < CPU_SETSIZE; id++) {
+				if (CPU_ISSET(id, &allowed)) {
+					cores.push_back({ id, 0 });
+				}
+			}
+		}
+		for (size_t node = 0; node < m_MaxNodes; node++) {
+			std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if (!in || !std::getline(in, list)) {
+				continue;
+			}
+			for (Core& core : cores) {
+				if (IsInList(list, core.m_id)) {
+					core.m_node = node;
+				}
+			}
+		}
+#endif
+		if (cores.empty()) {
+			for (size_t id = 0; id < std::max(std::thread::hardware_concurrency(), 1u); id++) {
+				cores.push_back({ id, 0 });
+			}
+		}
+		std::sort(cores.begin(), cores.end(), [](const Core& a, const Core& b) { return a.m_id < b.m_id; });
+		return cores;
+	}
+
+	// the thread may run on any of ids only; false if the platform refused or has no affinity API
+	static bool Bind(std::thread& thread, const std::vector<size_t>& ids) {
+		if (ids.empty()) {
+			return false;
+		}
+#if defined(_WIN32)
+		// a thread belongs to one processor group, ids of other groups are dropped
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = static_cast<WORD>(ids.front() / m_GroupSize);
+		for (size_t id : ids) {
+			if (id / m_GroupSize == affinity.Group) {
+				affinity.Mask |= KAFFINITY(1) << (id % m_GroupSize);
+			}
+		}
+		return SetThreadGroupAffinity(thread.native_handle(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t id : ids) {
+			CPU_SET(id, &set);
+		}
+		return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+private:
+#if defined(__linux__)
+	// list as in sysfs: "0-15,32-47"
+	static bool IsInList(const std::string& list, size_t id) {
+		std::stringstream ss(list);
+		std::string range;
+		while (std::getline(ss, range, ',')) {
+			if (range.empty()) {
+				continue;
+			}
+			size_t dash = range.find('-');
+			size_t first = std::stoul(range.substr(0, dash));
+			size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+			if (id >= first && id <= last) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static constexpr size_t m_MaxNodes = 64;
+#endif
+#if defined(_WIN32)
+	static constexpr size_t m_GroupSize = 64;
+#endif
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <future>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include "LibThreadPool.h"
+
+// lazily started coroutine: the body runs when the task is awaited, Detach()ed or Get() is called.
+// The awaiting coroutine continues on the thread that finished the task, an exception thrown by the
+// body is rethrown to the awaiter
+template<typename T = void>
+class LibAsyncTask {
+public:
+	struct promise_type;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	struct PromiseBase {
+		std::coroutine_handle<> m_continuation;
+		std::exception_ptr m_error;
+		bool m_isDetached = false;
+
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+
+		// hands the thread over to the awaiter, a detached frame frees itself
+		struct FinalAwaiter {
+			bool await_ready() noexcept {
+				return false;
+			}
+
+			template<typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+				PromiseBase& promise = handle.promise();
+				if (promise.m_continuation) {
+					return promise.m_continuation;
+				}
+				if (promise.m_isDetached) {
+					handle.destroy();
+				}
+				return std::noop_coroutine();
+			}
+
+			void await_resume() noexcept {}
+		};
+
+		FinalAwaiter final_suspend() noexcept {
+			return {};
+		}
+
+		void unhandled_exception() {
+			m_error = std::current_exception();
+		}
+	};
+
+	struct promise_type : PromiseBase {
+		std::optional<T> m_value;
+
+		LibAsyncTask get_return_object() {
+			return LibAsyncTask(Handle::from_promise(*this));
+		}
+
+		void return_value(T value) {
+			m_value = std::move(value);
+		}
+
+		T Result() {
+			if (this->m_error) {
+				std::rethrow_exception(this->m_error);
+			}
+			return std::move(*m_value);
+		}
+	};
+
+	LibAsyncTask() = default;
+
+	LibAsyncTask(LibAsyncTask&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+
+	LibAsyncTask& operator=(LibAsyncTask&& other) noexcept {
+		if (this != &other) {
+			Reset();
+			m_handle = std::exchange(other.m_handle, {});
+		}
+		return *this;
+	}
+
+	~LibAsyncTask() {
+		Reset();
+	}
+
+	bool await_ready() const noexcept {
+		return !m_handle || m_handle.done();
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		m_handle.promise().m_continuation = awaiting;
+		return m_handle;
+	}
+
+	T await_resume() {
+		return m_handle.promise().Result();
+	}
+
+	// starts the body with nobody awaiting it, the frame is freed when it ends
+	void Detach() {
+		Handle handle = std::exchange(m_handle, {});
+		handle.promise().m_isDetached = true;
+		handle.resume();
+	}
+
+	// runs the task and blocks the calling thread until it ends, for callers outside coroutines
+	T Get() {
+		std::promise<T> res;
+		[](LibAsyncTask& task, std::promise<T>& res) -> LibAsyncTask<void> {
+			try {
+				if constexpr (std::is_void_v<T>) {
+					co_await task;
+					res.set_value();
+				}
+				else {
+					res.set_value(co_await task);
+				}
+			}
+			catch (...) {
+				res.set_exception(std::current_exception());
+			}
+		}(*this, res).Detach();
+		return res.get_future().get();
+	}
+
+private:
+	explicit LibAsyncTask(Handle handle) : m_handle(handle) {}
+
+	void Reset() {
+		if (m_handle) {
+			m_handle.destroy();
+			m_handle = {};
+		}
+	}
+
+	Handle m_handle;
+};
+
+template<>
+struct LibAsyncTask<void>::promise_type : LibAsyncTask<void>::PromiseBase {
+	LibAsyncTask get_return_object() {
+		return LibAsyncTask(Handle::from_promise(*this));
+	}
+
+	void return_void() {}
+
+	void Result() {
+		if (m_error) {
+			std::rethrow_exception(m_error);
+		}
+	}
+};
+
+// awaitables that move a coroutine between threads
+class LibAsync {
+public:
+	struct PoolAwaiter {
+		LibThreadPool& m_tp;
+		LibPriority m_priority;
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			m_tp.Post(m_priority, [handle]() { handle.resume(); });
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	template<typename Post>
+	struct PostAwaiter {
+		Post m_post;
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			m_post(handle);
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	// co_await ResumeOn(tp) continues the coroutine on a worker of tp
+	static PoolAwaiter ResumeOn(LibThreadPool& tp, LibPriority priority = LibThreadPool::CurrentPriority()) {
+		return PoolAwaiter{ tp, priority };
+	}
+
+	// co_await ResumeVia(post) hands the coroutine to post(handle), which must resume it once on the
+	// thread it stands for, e.g. through the GUI event loop
+	template<typename Post>
+	static PostAwaiter<Post> ResumeVia(Post post) {
+		return PostAwaiter<Post>{ std::move(post) };
+	}
+
+	// starts all tasks on tp at once and continues once every one has ended, on the thread that ended
+	// the last one. The first exception thrown by a task is rethrown after all of them are done
+	static LibAsyncTask<void> WhenAll(LibThreadPool& tp, std::vector<LibAsyncTask<void>> tasks,
+		LibPriority priority = LibThreadPool::CurrentPriority()) {
+		AllAwaiter all{ tp, priority, tasks };
+		co_await all;
+	}
+
+private:
+	struct AllAwaiter {
+		AllAwaiter(LibThreadPool& tp, LibPriority priority, std::vector<LibAsyncTask<void>>& tasks) :
+			m_tp(tp), m_priority(priority), m_tasks(tasks) {}
+
+		LibThreadPool& m_tp;
+		LibPriority m_priority;
+		std::vector<LibAsyncTask<void>>& m_tasks;
+		std::atomic<size_t> m_left = 0;
+		std::mutex m_mutex;
+		std::exception_ptr m_error;
+
+		bool await_ready() const noexcept {
+			return m_tasks.empty();
+		}
+
+		// the loop holds one count itself, so the awaiter can't be resumed and destroyed before it ends
+		bool await_suspend(std::coroutine_handle<> handle) {
+			m_left = m_tasks.size() + 1;
+			for (LibAsyncTask<void>& task : m_tasks) {
+				Run(*this, task, handle).Detach();
+			}
+			return --m_left != 0;
+		}
+
+		void await_resume() {
+			if (m_error) {
+				std::rethrow_exception(m_error);
+			}
+		}
+
+		// the last task to end resumes the awaiter, nothing touches the awaiter after that
+		static LibAsyncTask<void> Run(AllAwaiter& all, LibAsyncTask<void>& task, std::coroutine_handle<> awaiting) {
+			co_await ResumeOn(all.m_tp, all.m_priority);
+			try {
+				co_await task;
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(all.m_mutex);
+				if (!all.m_error) {
+					all.m_error = std::current_exception();
+				}
+			}
+			if (--all.m_left == 0) {
+				awaiting.resume();
+			}
+		}
+	};
+};
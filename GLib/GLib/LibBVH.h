@@ -0,0 +1,797 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include "LibPoint.h"
+#include "LibRay.h"
+#include "LibAABB.h"
+#include "LibRayPacket.h"
+#include "LibAccel.h"
+#include "LibEps.h"
+#include "LibTimer.h"
+#include "LibThreadPool.h"
+#include "LibParallel.h"
+
+template<typename T, typename I = uint32_t>
+class LibBVH : public LibAccel<T, I> {
+public:
+	struct Node {
+		LibAABB<T> m_box;
+		uint32_t m_left;  // first position in Indices() for leaves
+		uint32_t m_right;
+		uint32_t m_count; // 0 for inner nodes
+
+		inline bool IsLeaf() const {
+			return m_count != 0;
+		}
+	};
+
+	LibBVH() = default;
+	~LibBVH() override = default;
+
+	inline bool IsEmpty() const {
+		return m_vecNodes.empty();
+	}
+
+	inline const std::vector<Node>& Nodes() const {
+		return m_vecNodes;
+	}
+
+	inline const std::vector<uint32_t>& Indices() const {
+		return m_vecIndices;
+	}
+
+	// levels below the root of the deepest leaf, traversal stacks hold one node per level
+	size_t Depth() const {
+		size_t depth = 0;
+		std::vector<std::pair<uint32_t, size_t>> stack;
+		if (!IsEmpty()) {
+			stack.push_back({ 0, 0 });
+		}
+		while (!stack.empty()) {
+			auto [idx, nodeDepth] = stack.back();
+			stack.pop_back();
+			depth = std::max(depth, nodeDepth);
+			if (!m_vecNodes[idx].IsLeaf()) {
+				stack.push_back({ m_vecNodes[idx].m_left, nodeDepth + 1 });
+				stack.push_back({ m_vecNodes[idx].m_right, nodeDepth + 1 });
+			}
+		}
+		return depth;
+	}
+
+	typename LibAccel<T, I>::Type GetType() const override {
+		return LibAccel<T, I>::Type::BVH;
+	}
+
+	void Save(std::ostream& out) const override {
+		LibUtility::SaveBuf(out, m_vecNodes);
+		LibUtility::SaveBuf(out, m_vecIndices);
+	}
+
+	void Load(std::istream& in) override {
+		LibUtility::LoadBuf(in, m_vecNodes);
+		LibUtility::LoadBuf(in, m_vecIndices);
+	}
+
+	void Build(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls) {
+		TIMER_START("build SAH BVH");
+		m_vecNodes.clear();
+		m_vecIndices.clear();
+
+		const size_t trnglsCount = trngls.size() / 3;
+		if (trnglsCount == 0) {
+			TIMER_END("build SAH BVH");
+			return;
+		}
+
+		std::vector<LibPoint<T>> centroids(trnglsCount);
+		m_vecIndices.resize(trnglsCount);
+		for (size_t i = 0; i < trnglsCount; i++) {
+			centroids[i] = Centroid(pts, trngls, i);
+			m_vecIndices[i] = static_cast<uint32_t>(i);
+		}
+
+		m_vecNodes.reserve(2 * trnglsCount);
+		BuildRange(pts, trngls, centroids, 0, static_cast<uint32_t>(trnglsCount), 0, m_vecNodes);
+
+		Refit(pts, trngls);
+		TIMER_END("build SAH BVH");
+	}
+
+	// same tree as Build, the two halves of every big node are built by a fork-join on the pool
+	void Build(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, LibThreadPool& tp) {
+		m_vecNodes.clear();
+		m_vecIndices.clear();
+
+		const size_t trnglsCount = trngls.size() / 3;
+		if (trnglsCount == 0) {
+			return;
+		}
+
+		std::vector<LibPoint<T>> centroids(trnglsCount);
+		m_vecIndices.resize(trnglsCount);
+		LibParallel::ForEach(tp, 0, trnglsCount, m_ParallelGrain, [&](size_t i) {
+			centroids[i] = Centroid(pts, trngls, i);
+			m_vecIndices[i] = static_cast<uint32_t>(i);
+		});
+
+		BuildRange(pts, trngls, centroids, 0, static_cast<uint32_t>(trnglsCount), 0, m_vecNodes, tp);
+		Refit(pts, trngls);
+	}
+
+	// linear BVH: Morton codes of centroids, parallel radix sort and Karras hierarchy emission.
+	// Consecutive sorted triangles are grouped into leaves of m_LBVHLeafSize.
+	void BuildLBVH(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, LibThreadPool& tp) {
+		TIMER_START("build LBVH");
+		m_vecNodes.clear();
+		m_vecIndices.clear();
+
+		const size_t trnglsCount = trngls.size() / 3;
+		if (trnglsCount == 0) {
+			TIMER_END("build LBVH");
+			return;
+		}
+
+		const size_t chunksCount = std::max<size_t>(1, std::min<size_t>(tp.ThreadsNum() * 4, trnglsCount / m_ParallelGrain));
+		auto chunkBegin = [](size_t chunk, size_t chunks, size_t count) { return chunk * count / chunks; };
+
+		LibAABB<T> cntrBox = LibParallel::Reduce(tp, 0, trnglsCount, m_ParallelGrain, LibAABB<T>(),
+			[&](size_t first, size_t last) {
+				LibAABB<T> box;
+				for (size_t i = first; i < last; i++) {
+					box.Extend(Centroid(pts, trngls, i));
+				}
+				return box;
+			},
+			[](LibAABB<T> box, const LibAABB<T>& other) { return box.Extend(other); });
+
+		std::vector<uint32_t> codes(trnglsCount);
+		m_vecIndices.resize(trnglsCount);
+		LibParallel::ForEach(tp, 0, trnglsCount, m_ParallelGrain, [&](size_t i) {
+			codes[i] = MortonCode(Centroid(pts, trngls, i), cntrBox);
+			m_vecIndices[i] = static_cast<uint32_t>(i);
+		});
+
+		RadixSort(codes, tp, chunksCount);
+
+		const size_t leavesCount = (trnglsCount + m_LBVHLeafSize - 1) / m_LBVHLeafSize;
+		const size_t innerCount = leavesCount - 1;
+		m_vecNodes.resize(innerCount + leavesCount);
+		std::vector<uint32_t> parents(m_vecNodes.size(), UINT32_MAX);
+
+		auto delta = [&](int64_t i, int64_t j) -> int {
+			if (j < 0 || j >= static_cast<int64_t>(leavesCount)) {
+				return -1;
+			}
+			uint32_t codeI = codes[i * m_LBVHLeafSize];
+			uint32_t codeJ = codes[j * m_LBVHLeafSize];
+			if (codeI != codeJ) {
+				return std::countl_zero(codeI ^ codeJ);
+			}
+			return 32 + std::countl_zero(static_cast<uint64_t>(i ^ j));
+		};
+
+		const size_t leafChunks = std::max<size_t>(1, std::min(chunksCount, leavesCount / 256));
+		LibParallel::ForEach(tp, 0, leafChunks, 1, [&](size_t chunk) {
+			size_t leavesEnd = chunkBegin(chunk + 1, leafChunks, leavesCount);
+			for (size_t leaf = chunkBegin(chunk, leafChunks, leavesCount); leaf < leavesEnd; leaf++) {
+				Node& node = m_vecNodes[innerCount + leaf];
+				node.m_left = static_cast<uint32_t>(leaf * m_LBVHLeafSize);
+				node.m_right = 0;
+				node.m_count = static_cast<uint32_t>(std::min(m_LBVHLeafSize, trnglsCount - leaf * m_LBVHLeafSize));
+			}
+
+			size_t end = chunkBegin(chunk + 1, leafChunks, innerCount);
+			for (size_t i = chunkBegin(chunk, leafChunks, innerCount); i < end; i++) {
+				int64_t idx = static_cast<int64_t>(i);
+				int dir = delta(idx, idx + 1) - delta(idx, idx - 1) >= 0 ? 1 : -1;
+				int deltaMin = delta(idx, idx - dir);
+
+				int64_t lenMax = 2;
+				while (delta(idx, idx + lenMax * dir) > deltaMin) {
+					lenMax *= 2;
+				}
+
+				int64_t len = 0;
+				for (int64_t t = lenMax / 2; t >= 1; t /= 2) {
+					if (delta(idx, idx + (len + t) * dir) > deltaMin) {
+						len += t;
+					}
+				}
+				int64_t last = idx + len * dir;
+
+				int deltaNode = delta(idx, last);
+				int64_t split = 0;
+				for (int64_t div = 2, t = (len + 1) / 2; ; div *= 2, t = (len + div - 1) / div) {
+					if (delta(idx, idx + (split + t) * dir) > deltaNode) {
+						split += t;
+					}
+					if (t <= 1) {
+						break;
+					}
+				}
+				int64_t gamma = idx + split * dir + std::min(dir, 0);
+
+				uint32_t left = static_cast<uint32_t>(std::min(idx, last) == gamma ? innerCount + gamma : gamma);
+				uint32_t right = static_cast<uint32_t>(std::max(idx, last) == gamma + 1 ? innerCount + gamma + 1 : gamma + 1);
+
+				Node& node = m_vecNodes[i];
+				node.m_left = left;
+				node.m_right = right;
+				node.m_count = 0;
+				parents[left] = static_cast<uint32_t>(i);
+				parents[right] = static_cast<uint32_t>(i);
+			}
+		});
+
+		std::vector<std::atomic<uint32_t>> visits(innerCount);
+		LibParallel::ForEach(tp, 0, leafChunks, 1, [&](size_t chunk) {
+			size_t end = chunkBegin(chunk + 1, leafChunks, leavesCount);
+			for (size_t leaf = chunkBegin(chunk, leafChunks, leavesCount); leaf < end; leaf++) {
+				uint32_t idx = static_cast<uint32_t>(innerCount + leaf);
+				m_vecNodes[idx].m_box = LeafBox(pts, trngls, m_vecNodes[idx]);
+
+				// the second child to arrive builds the parent box
+				for (idx = parents[idx]; idx != UINT32_MAX; idx = parents[idx]) {
+					if (visits[idx].fetch_add(1, std::memory_order_acq_rel) == 0) {
+						break;
+					}
+					Node& node = m_vecNodes[idx];
+					node.m_box = m_vecNodes[node.m_left].m_box;
+					node.m_box.Extend(m_vecNodes[node.m_right].m_box);
+				}
+			}
+		});
+
+		TIMER_END("build LBVH");
+	}
+
+	using LibAccel<T, I>::IsIntersectionRay;
+
+	// nodes are clipped to [tMin, dist], so the interval shrinks with every hit
+	bool IsIntersectionRay(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMin, T tMax, T& dist, size_t& ind,
+		const LibCancelToken* token) const override {
+		if (IsEmpty()) {
+			return false;
+		}
+
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+
+		dist = tMax;
+		bool isFound = false;
+
+		T tNear, tFar;
+		if (!m_vecNodes[0].m_box.IsIntersectionRay(ray.Origin(), dirInv, tMin, dist, tNear, tFar)) {
+			return false;
+		}
+
+		uint32_t stack[m_StackSize];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		size_t visited = 0;
+		while (stackSize != 0) {
+			if (token && visited++ % LibAccel<T, I>::m_CancelPoll == 0 && token->IsCancelled()) {
+				return false;
+			}
+
+			const Node& node = m_vecNodes[stack[--stackSize]];
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+					size_t trngl = m_vecIndices[i];
+					T curDist;
+					if (mdl.IsIntersectionTrngl(ray.Origin(), dir, trngl, curDist) && curDist >= tMin &&
+						(curDist < dist || (isFound && curDist == dist && trngl < ind))) {
+						dist = curDist;
+						ind = trngl;
+						isFound = true;
+					}
+				}
+				continue;
+			}
+
+			T tLeft, tRight;
+			bool isLeft = m_vecNodes[node.m_left].m_box.IsIntersectionRay(ray.Origin(), dirInv, tMin, dist, tLeft, tFar);
+			bool isRight = m_vecNodes[node.m_right].m_box.IsIntersectionRay(ray.Origin(), dirInv, tMin, dist, tRight, tFar);
+
+			if (isLeft && isRight) {
+				if (tLeft <= tRight) {
+					stack[stackSize++] = node.m_right;
+					stack[stackSize++] = node.m_left;
+				}
+				else {
+					stack[stackSize++] = node.m_left;
+					stack[stackSize++] = node.m_right;
+				}
+			}
+			else if (isLeft) {
+				stack[stackSize++] = node.m_left;
+			}
+			else if (isRight) {
+				stack[stackSize++] = node.m_right;
+			}
+		}
+
+		return isFound;
+	}
+
+	// the packet descends while any lane hits the node, children are ordered by the direction of the first ray
+	void IsIntersectionPacket(const LibModel<T, I>& mdl, const LibRayPacket<T>& packet, T* dist, size_t* ind) const override {
+		using Pack = typename LibRayPacket<T>::Pack;
+		std::fill(dist, dist + LibRayPacket<T>::Size, std::numeric_limits<T>::max());
+		std::fill(ind, ind + LibRayPacket<T>::Size, 0);
+		if (IsEmpty()) {
+			return;
+		}
+
+		Pack tMax(std::numeric_limits<T>::max());
+		const LibVector<T>& dir = packet.Ray(0).Direction();
+
+		uint32_t stack[m_StackSize];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize != 0) {
+			const Node& node = m_vecNodes[stack[--stackSize]];
+			if (!packet.IsIntersectionBox(node.m_box, tMax).Any()) {
+				continue;
+			}
+
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+					size_t trngl = m_vecIndices[i];
+					packet.IntersectTrngl(mdl.GetPtInTrngl(trngl, 0), mdl.GetPtInTrngl(trngl, 1),
+						mdl.GetPtInTrngl(trngl, 2), trngl, tMax, dist, ind);
+				}
+				continue;
+			}
+
+			LibVector<T> shift = m_vecNodes[node.m_right].m_box.Center() - m_vecNodes[node.m_left].m_box.Center();
+			size_t axis = 0;
+			for (size_t i = 1; i < 3; i++) {
+				if (std::fabs(shift.At(i)) > std::fabs(shift.At(axis))) {
+					axis = i;
+				}
+			}
+
+			if (shift.At(axis) * dir.At(axis) >= 0) {
+				stack[stackSize++] = node.m_right;
+				stack[stackSize++] = node.m_left;
+			}
+			else {
+				stack[stackSize++] = node.m_left;
+				stack[stackSize++] = node.m_right;
+			}
+		}
+	}
+
+	bool IsOccluded(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMax) const override {
+		if (IsEmpty()) {
+			return false;
+		}
+
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+
+		uint32_t stack[m_StackSize];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize != 0) {
+			const Node& node = m_vecNodes[stack[--stackSize]];
+			T tNear;
+			if (!node.m_box.IsIntersectionRay(ray.Origin(), dirInv, tMax, tNear)) {
+				continue;
+			}
+
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+					T dist;
+					if (mdl.IsIntersectionTrngl(ray.Origin(), dir, m_vecIndices[i], dist) && dist < tMax) {
+						return true;
+					}
+				}
+				continue;
+			}
+
+			stack[stackSize++] = node.m_right;
+			stack[stackSize++] = node.m_left;
+		}
+
+		return false;
+	}
+
+	void IntersectAll(const LibModel<T, I>& mdl, const LibRay<T>& ray, std::vector<LibHit<T>>& hits) const override {
+		if (IsEmpty()) {
+			return;
+		}
+
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+
+		uint32_t stack[m_StackSize];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize != 0) {
+			const Node& node = m_vecNodes[stack[--stackSize]];
+			T tNear;
+			if (!node.m_box.IsIntersectionRay(ray.Origin(), dirInv, std::numeric_limits<T>::max(), tNear)) {
+				continue;
+			}
+
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+					LibHit<T> hit;
+					hit.m_trngl = m_vecIndices[i];
+					if (mdl.IsIntersectionTrngl(ray.Origin(), dir, hit.m_trngl, hit.m_dist, hit.m_u, hit.m_v)) {
+						hits.push_back(hit);
+					}
+				}
+				continue;
+			}
+
+			stack[stackSize++] = node.m_right;
+			stack[stackSize++] = node.m_left;
+		}
+	}
+
+	// lanes drop out of the traversal once occluded, it ends when all of them are
+	int IsOccludedPacket(const LibModel<T, I>& mdl, const LibRayPacket<T>& packet, const T* tMax) const override {
+		using Pack = typename LibRayPacket<T>::Pack;
+		using Mask = typename LibRayPacket<T>::Mask;
+		if (IsEmpty()) {
+			return 0;
+		}
+
+		T bounds[LibRayPacket<T>::Size];
+		for (size_t lane = 0; lane < LibRayPacket<T>::Size; lane++) {
+			bounds[lane] = tMax[std::min(lane, packet.Count() - 1)];
+		}
+		const Pack tMaxPack = Pack::Load(bounds);
+		const int all = (1 << packet.Count()) - 1;
+		int occluded = 0;
+
+		uint32_t stack[m_StackSize];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize != 0) {
+			const Node& node = m_vecNodes[stack[--stackSize]];
+			Mask pending(all & ~occluded);
+			if (!(packet.IsIntersectionBox(node.m_box, tMaxPack) & pending).Any()) {
+				continue;
+			}
+
+			if (node.IsLeaf()) {
+				for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+					size_t trngl = m_vecIndices[i];
+					Pack dist;
+					Mask hit = packet.IsIntersectionTrngl(mdl.GetPtInTrngl(trngl, 0), mdl.GetPtInTrngl(trngl, 1),
+						mdl.GetPtInTrngl(trngl, 2), tMaxPack, dist);
+					occluded |= (hit & (dist < tMaxPack)).Bits();
+					if (occluded == all) {
+						return all;
+					}
+				}
+				continue;
+			}
+
+			stack[stackSize++] = node.m_right;
+			stack[stackSize++] = node.m_left;
+		}
+
+		return occluded;
+	}
+
+protected:
+	static LibPoint<T> Centroid(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, size_t trngl) {
+		const LibPoint<T>& A = pts[trngls[3 * trngl]];
+		const LibPoint<T>& B = pts[trngls[3 * trngl + 1]];
+		const LibPoint<T>& C = pts[trngls[3 * trngl + 2]];
+		return LibPoint<T>((A.X() + B.X() + C.X()) / 3, (A.Y() + B.Y() + C.Y()) / 3, (A.Z() + B.Z() + C.Z()) / 3);
+	}
+
+	static LibAABB<T> TrnglBox(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, size_t trngl) {
+		LibAABB<T> box;
+		box.Extend(pts[trngls[3 * trngl]]);
+		box.Extend(pts[trngls[3 * trngl + 1]]);
+		box.Extend(pts[trngls[3 * trngl + 2]]);
+		return box;
+	}
+
+	// leaves are padded so that hits accepted by the triangle test on an edge are never culled
+	LibAABB<T> LeafBox(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, const Node& node) const {
+		LibAABB<T> box;
+		for (uint32_t i = node.m_left; i < node.m_left + node.m_count; i++) {
+			box.Extend(TrnglBox(pts, trngls, m_vecIndices[i]));
+		}
+		T maxCoord = std::max({ std::fabs(box.Min().X()), std::fabs(box.Min().Y()), std::fabs(box.Min().Z()),
+			std::fabs(box.Max().X()), std::fabs(box.Max().Y()), std::fabs(box.Max().Z()) });
+		box.Inflate(static_cast<T>(LibEps::eps * (1 + maxCoord)));
+		return box;
+	}
+
+	void Refit(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls) {
+		for (size_t i = m_vecNodes.size(); i-- > 0;) {
+			Node& node = m_vecNodes[i];
+			node.m_box = LibAABB<T>();
+			if (node.IsLeaf()) {
+				node.m_box = LeafBox(pts, trngls, node);
+			}
+			else {
+				node.m_box.Extend(m_vecNodes[node.m_left].m_box);
+				node.m_box.Extend(m_vecNodes[node.m_right].m_box);
+			}
+		}
+	}
+
+	std::vector<Node> m_vecNodes;
+	std::vector<uint32_t> m_vecIndices;
+
+	// a tree of depth d needs d + 1 entries. Split makes a leaf of any node at m_StackSize - 1, an LBVH is
+	// at most 62 levels deep: the common prefix of 30 key bits and 32 index bits grows at every level
+	static constexpr size_t m_StackSize = 128;
+
+private:
+	// 10 bits per axis interleaved into a 30-bit key, equal keys are ordered by index in delta()
+	static uint32_t ExpandBits(uint32_t val) {
+		val &= 0x3ff;
+		val = (val | val << 16) & 0x30000ff;
+		val = (val | val << 8) & 0x300f00f;
+		val = (val | val << 4) & 0x30c30c3;
+		val = (val | val << 2) & 0x9249249;
+		return val;
+	}
+
+	static uint32_t MortonCode(const LibPoint<T>& pt, const LibAABB<T>& box) {
+		uint32_t code = 0;
+		for (size_t axis = 0; axis < 3; axis++) {
+			T extent = box.Max().At(axis) - box.Min().At(axis);
+			T rel = extent > 0 ? (pt.At(axis) - box.Min().At(axis)) / extent : 0;
+			uint32_t cell = static_cast<uint32_t>(std::clamp<T>(rel * 1024, 0, 1023));
+			code |= ExpandBits(cell) << (2 - axis);
+		}
+		return code;
+	}
+
+	// LSD radix sort of codes carrying m_vecIndices along, 11 bits per pass
+	void RadixSort(std::vector<uint32_t>& codes, LibThreadPool& tp, size_t chunksCount) {
+		const size_t count = codes.size();
+		auto chunkBegin = [&](size_t chunk) { return chunk * count / chunksCount; };
+
+		std::vector<uint32_t> tmpCodes(count);
+		std::vector<uint32_t> tmpIndices(count);
+		std::vector<size_t> hist(chunksCount * m_RadixSize);
+
+		for (int shift = 0; shift < 30; shift += m_RadixBits) {
+			std::fill(hist.begin(), hist.end(), 0);
+			LibParallel::ForEach(tp, 0, chunksCount, 1, [&](size_t chunk) {
+				size_t* chunkHist = hist.data() + chunk * m_RadixSize;
+				for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++) {
+					chunkHist[(codes[i] >> shift) & (m_RadixSize - 1)]++;
+				}
+			});
+
+			size_t offset = 0;
+			bool isSorted = false;
+			for (size_t digit = 0; digit < m_RadixSize; digit++) {
+				size_t digitCount = 0;
+				for (size_t chunk = 0; chunk < chunksCount; chunk++) {
+					size_t val = hist[chunk * m_RadixSize + digit];
+					hist[chunk * m_RadixSize + digit] = offset;
+					offset += val;
+					digitCount += val;
+				}
+				isSorted = isSorted || digitCount == count;
+			}
+			if (isSorted) {
+				continue;
+			}
+
+			LibParallel::ForEach(tp, 0, chunksCount, 1, [&](size_t chunk) {
+				size_t* chunkHist = hist.data() + chunk * m_RadixSize;
+				for (size_t i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++) {
+					size_t pos = chunkHist[(codes[i] >> shift) & (m_RadixSize - 1)]++;
+					tmpCodes[pos] = codes[i];
+					tmpIndices[pos] = m_vecIndices[i];
+				}
+			});
+
+			codes.swap(tmpCodes);
+			m_vecIndices.swap(tmpIndices);
+		}
+	}
+
+	// subtree over m_vecIndices[first, first + count) appended to nodes, children after their parent
+	void BuildRange(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls,
+		const std::vector<LibPoint<T>>& centroids, uint32_t first, uint32_t count, uint32_t depth,
+		std::vector<Node>& nodes) {
+		const uint32_t root = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node{ LibAABB<T>(), first, 0, count });
+
+		std::vector<std::pair<uint32_t, uint32_t>> stack = { { root, depth } };
+		while (!stack.empty()) {
+			uint32_t idx = stack.back().first;
+			uint32_t nodeDepth = stack.back().second;
+			stack.pop_back();
+
+			uint32_t nodeFirst = nodes[idx].m_left;
+			uint32_t nodeCount = nodes[idx].m_count;
+			uint32_t mid;
+			if (!Split(pts, trngls, centroids, nodeFirst, nodeCount, nodeDepth, mid)) {
+				continue;
+			}
+
+			uint32_t left = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(Node{ LibAABB<T>(), nodeFirst, 0, mid - nodeFirst });
+			nodes.push_back(Node{ LibAABB<T>(), mid, 0, nodeFirst + nodeCount - mid });
+
+			nodes[idx].m_left = left;
+			nodes[idx].m_right = left + 1;
+			nodes[idx].m_count = 0;
+
+			stack.push_back({ left, nodeDepth + 1 });
+			stack.push_back({ left + 1, nodeDepth + 1 });
+		}
+	}
+
+	// the left half goes to the pool and the right one is built inline, the wait runs other halves.
+	// Split only reorders the node's own part of m_vecIndices, so the halves never touch the same data
+	void BuildRange(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls,
+		const std::vector<LibPoint<T>>& centroids, uint32_t first, uint32_t count, uint32_t depth,
+		std::vector<Node>& nodes, LibThreadPool& tp) {
+		uint32_t mid;
+		if (count < m_ForkSize) {
+			BuildRange(pts, trngls, centroids, first, count, depth, nodes);
+			return;
+		}
+		if (!Split(pts, trngls, centroids, first, count, depth, mid)) {
+			nodes.push_back(Node{ LibAABB<T>(), first, 0, count });
+			return;
+		}
+
+		std::vector<Node> left, right;
+		{
+			LibTaskGroup group(tp);
+			group.Run([&]() { BuildRange(pts, trngls, centroids, first, mid - first, depth + 1, left, tp); });
+			BuildRange(pts, trngls, centroids, mid, first + count - mid, depth + 1, right, tp);
+			group.Wait();
+		}
+
+		const uint32_t root = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node{ LibAABB<T>(), root + 1, root + 1 + static_cast<uint32_t>(left.size()), 0 });
+		Append(nodes, left);
+		Append(nodes, right);
+	}
+
+	// child links of src are relative to src, they are moved by where src lands in nodes
+	static void Append(std::vector<Node>& nodes, const std::vector<Node>& src) {
+		const uint32_t offset = static_cast<uint32_t>(nodes.size());
+		for (Node node : src) {
+			if (!node.IsLeaf()) {
+				node.m_left += offset;
+				node.m_right += offset;
+			}
+			nodes.push_back(node);
+		}
+	}
+
+	// binned SAH, falls back to a median split for unsplittable or too deep nodes. Nodes at the depth
+	// the traversal stacks end at stay leaves whatever their size
+	bool Split(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls,
+		const std::vector<LibPoint<T>>& centroids, uint32_t first, uint32_t count, uint32_t depth, uint32_t& mid) {
+		if (count <= m_MinLeafSize || depth + 1 >= m_StackSize) {
+			return false;
+		}
+
+		uint32_t* beg = m_vecIndices.data() + first;
+		uint32_t* end = beg + count;
+
+		LibAABB<T> box, cntrBox;
+		for (uint32_t* it = beg; it != end; ++it) {
+			box.Extend(TrnglBox(pts, trngls, *it));
+			cntrBox.Extend(centroids[*it]);
+		}
+
+		T bestCost = std::numeric_limits<T>::max();
+		int bestAxis = -1;
+		size_t bestBin = 0;
+
+		if (depth < m_MaxSAHDepth) {
+			for (int axis = 0; axis < 3; axis++) {
+				T cntrMin = cntrBox.Min().At(axis);
+				T extent = cntrBox.Max().At(axis) - cntrMin;
+				if (extent <= 0) {
+					continue;
+				}
+
+				LibAABB<T> bins[m_BinsCount];
+				uint32_t binsCount[m_BinsCount] = {};
+				T scale = m_BinsCount / extent;
+				for (uint32_t* it = beg; it != end; ++it) {
+					size_t bin = BinIndex(centroids[*it].At(axis), cntrMin, scale);
+					binsCount[bin]++;
+					bins[bin].Extend(TrnglBox(pts, trngls, *it));
+				}
+
+				T rightArea[m_BinsCount];
+				uint32_t rightCount[m_BinsCount];
+				LibAABB<T> acc;
+				uint32_t accCount = 0;
+				for (size_t i = m_BinsCount - 1; i > 0; i--) {
+					acc.Extend(bins[i]);
+					accCount += binsCount[i];
+					rightArea[i] = acc.SurfaceArea();
+					rightCount[i] = accCount;
+				}
+
+				acc = LibAABB<T>();
+				accCount = 0;
+				for (size_t i = 0; i < m_BinsCount - 1; i++) {
+					acc.Extend(bins[i]);
+					accCount += binsCount[i];
+					if (accCount == 0 || rightCount[i + 1] == 0) {
+						continue;
+					}
+					T cost = acc.SurfaceArea() * accCount + rightArea[i + 1] * rightCount[i + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = i;
+					}
+				}
+			}
+		}
+
+		T leafCost = box.SurfaceArea() * count;
+		T splitCost = box.SurfaceArea() * m_TraversalCost + bestCost;
+		if (bestAxis != -1 && (splitCost < leafCost || count > m_MaxLeafSize)) {
+			T cntrMin = cntrBox.Min().At(bestAxis);
+			T scale = m_BinsCount / (cntrBox.Max().At(bestAxis) - cntrMin);
+			uint32_t* pivot = std::partition(beg, end, [&](uint32_t trngl) {
+				return BinIndex(centroids[trngl].At(bestAxis), cntrMin, scale) <= bestBin;
+			});
+			mid = static_cast<uint32_t>(pivot - m_vecIndices.data());
+			return true;
+		}
+
+		if (count <= m_MaxLeafSize) {
+			return false;
+		}
+
+		int axis = cntrBox.MaxAxis();
+		uint32_t* median = beg + count / 2;
+		std::nth_element(beg, median, end, [&](uint32_t a, uint32_t b) {
+			return centroids[a].At(axis) < centroids[b].At(axis);
+		});
+		mid = static_cast<uint32_t>(median - m_vecIndices.data());
+		return true;
+	}
+
+	static size_t BinIndex(T coord, T cntrMin, T scale) {
+		size_t bin = static_cast<size_t>((coord - cntrMin) * scale);
+		return std::min(bin, m_BinsCount - 1);
+	}
+
+	static constexpr size_t m_BinsCount = 16;
+	static constexpr uint32_t m_MinLeafSize = 2;
+	static constexpr uint32_t m_MaxLeafSize = 8;
+	static constexpr uint32_t m_MaxSAHDepth = 64;
+	static_assert(m_MaxSAHDepth < m_StackSize, "SAH splits must stop before the traversal stack is full");
+	static constexpr size_t m_LBVHLeafSize = 4;
+	static constexpr size_t m_ParallelGrain = 1024;
+	static constexpr uint32_t m_ForkSize = 4096;
+	static constexpr int m_RadixBits = 11;
+	static constexpr size_t m_RadixSize = size_t(1) << m_RadixBits;
+	static constexpr T m_TraversalCost = 1;
+};
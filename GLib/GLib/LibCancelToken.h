@@ -0,0 +1,23 @@
+#pragma once
+
+#include <atomic>
+
+// set once by the requester, polled by long running loops which then give up early
+class LibCancelToken {
+public:
+	LibCancelToken() : m_isCancelled(false) {}
+
+	LibCancelToken(const LibCancelToken&) = delete;
+	LibCancelToken& operator=(const LibCancelToken&) = delete;
+
+	inline void Cancel() {
+		m_isCancelled.store(true, std::memory_order_relaxed);
+	}
+
+	inline bool IsCancelled() const {
+		return m_isCancelled.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> m_isCancelled;
+};
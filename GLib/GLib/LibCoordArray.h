@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include "LibPoint.h"
+#include "LibVector.h"
+#include "LibAABB.h"
+#include "LibSimd.h"
+#include "LibUtility.h"
+
+// structure of arrays form of points or vectors: X, Y and Z in separate arrays, each aligned for
+// LibPack4 loads, so four elements come in with one load per coordinate instead of a strided gather
+template<typename T>
+class LibCoordArray {
+public:
+	using Pack = LibPack4<T>;
+	static constexpr size_t Align = sizeof(T) * Pack::Size;
+	using Array_t = std::vector<T, LibAlignedAllocator<T, Align>>;
+
+	template<typename Coords>
+	void Assign(const std::vector<Coords>& coords) {
+		m_x.resize(coords.size());
+		m_y.resize(coords.size());
+		m_z.resize(coords.size());
+		for (size_t i = 0; i < coords.size(); i++) {
+			m_x[i] = coords[i].X();
+			m_y[i] = coords[i].Y();
+			m_z[i] = coords[i].Z();
+		}
+	}
+
+	void Clear() {
+		Array_t().swap(m_x);
+		Array_t().swap(m_y);
+		Array_t().swap(m_z);
+	}
+
+	inline size_t Size() const {
+		return m_x.size();
+	}
+
+	inline const T* X() const {
+		return m_x.data();
+	}
+
+	inline const T* Y() const {
+		return m_y.data();
+	}
+
+	inline const T* Z() const {
+		return m_z.data();
+	}
+
+	inline LibPoint<T> Point(size_t i) const {
+		return LibPoint<T>(m_x[i], m_y[i], m_z[i]);
+	}
+
+	inline LibVector<T> Vector(size_t i) const {
+		return LibVector<T>(m_x[i], m_y[i], m_z[i]);
+	}
+
+	// box of elements [first, last): whole packs from the first aligned one, the ends one by one
+	LibAABB<T> BoundingBox(size_t first, size_t last) const {
+		LibAABB<T> box;
+		size_t i = first;
+		for (; i < last && i % Pack::Size != 0; i++) {
+			box.Extend(Point(i));
+		}
+		if (i + Pack::Size <= last) {
+			Pack minX = Pack::Load(&m_x[i]), minY = Pack::Load(&m_y[i]), minZ = Pack::Load(&m_z[i]);
+			Pack maxX = minX, maxY = minY, maxZ = minZ;
+			for (i += Pack::Size; i + Pack::Size <= last; i += Pack::Size) {
+				Pack x = Pack::Load(&m_x[i]), y = Pack::Load(&m_y[i]), z = Pack::Load(&m_z[i]);
+				minX = Pack::Min(minX, x);
+				minY = Pack::Min(minY, y);
+				minZ = Pack::Min(minZ, z);
+				maxX = Pack::Max(maxX, x);
+				maxY = Pack::Max(maxY, y);
+				maxZ = Pack::Max(maxZ, z);
+			}
+			alignas(Align) T lanes[6][Pack::Size];
+			minX.Store(lanes[0]);
+			minY.Store(lanes[1]);
+			minZ.Store(lanes[2]);
+			maxX.Store(lanes[3]);
+			maxY.Store(lanes[4]);
+			maxZ.Store(lanes[5]);
+			for (size_t lane = 0; lane < Pack::Size; lane++) {
+				box.Extend(LibPoint<T>(lanes[0][lane], lanes[1][lane], lanes[2][lane]));
+				box.Extend(LibPoint<T>(lanes[3][lane], lanes[4][lane], lanes[5][lane]));
+			}
+		}
+		for (; i < last; i++) {
+			box.Extend(Point(i));
+		}
+		return box;
+	}
+
+private:
+	Array_t m_x;
+	Array_t m_y;
+	Array_t m_z;
+};
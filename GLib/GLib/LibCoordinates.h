@@ -26,6 +26,11 @@ public:
 		return m_z;
 	};
 
+	inline T At(size_t axis) const
+	{
+		return (&m_x)[axis];
+	};
+
 	inline LibCoordinates<T>& SetX(T x)
 	{
 		m_x = x;
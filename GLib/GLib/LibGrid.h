@@ -0,0 +1,297 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "LibPoint.h"
+#include "LibVector.h"
+#include "LibRay.h"
+#include "LibAABB.h"
+#include "LibAccel.h"
+#include "LibEps.h"
+#include "LibTimer.h"
+
+// uniform grid walked with 3D-DDA, suits meshes with evenly sized triangles
+template<typename T, typename I = uint32_t>
+class LibGrid : public LibAccel<T, I> {
+public:
+	LibGrid() = default;
+	~LibGrid() override = default;
+
+	inline bool IsEmpty() const {
+		return m_vecCellTrngls.empty();
+	}
+
+	inline const LibAABB<T>& Box() const {
+		return m_box;
+	}
+
+	inline size_t CellsNum() const {
+		return m_vecCellStart.empty() ? 0 : m_vecCellStart.size() - 1;
+	}
+
+	inline size_t Resolution(size_t axis) const {
+		return m_Res[axis];
+	}
+
+	typename LibAccel<T, I>::Type GetType() const override {
+		return LibAccel<T, I>::Type::Grid;
+	}
+
+	void Save(std::ostream& out) const override {
+		m_box.Save(out);
+		LibUtility::Save(out, m_Pad);
+		LibUtility::SaveData(out, m_Res, 3);
+		LibUtility::SaveData(out, m_CellSize, 3);
+		LibUtility::SaveBuf(out, m_vecCellStart);
+		LibUtility::SaveBuf(out, m_vecCellTrngls);
+	}
+
+	void Load(std::istream& in) override {
+		m_box.Load(in);
+		LibUtility::Load(in, m_Pad);
+		LibUtility::LoadData(in, m_Res, 3);
+		LibUtility::LoadData(in, m_CellSize, 3);
+		LibUtility::LoadBuf(in, m_vecCellStart);
+		LibUtility::LoadBuf(in, m_vecCellTrngls);
+	}
+
+	void Build(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls) {
+		TIMER_START("build uniform grid");
+		m_vecCellStart.clear();
+		m_vecCellTrngls.clear();
+		m_box = LibAABB<T>();
+
+		const size_t trnglsCount = trngls.size() / 3;
+		for (size_t i = 0; i < trngls.size(); i++) {
+			m_box.Extend(pts[trngls[i]]);
+		}
+		if (trnglsCount == 0) {
+			TIMER_END("build uniform grid");
+			return;
+		}
+
+		m_Pad = static_cast<T>(LibEps::eps * (1 + std::max({ std::fabs(m_box.Min().X()), std::fabs(m_box.Min().Y()),
+			std::fabs(m_box.Min().Z()), std::fabs(m_box.Max().X()), std::fabs(m_box.Max().Y()), std::fabs(m_box.Max().Z()) })));
+		m_box.Inflate(m_Pad);
+
+		LibVector<T> diag = m_box.Diagonal();
+		T maxExtent = std::max({ diag.X(), diag.Y(), diag.Z() });
+		T volume = 1;
+		for (size_t axis = 0; axis < 3; axis++) {
+			volume *= std::max(diag.At(axis), maxExtent * m_MinRelExtent);
+		}
+		T cellsPerUnit = std::cbrt(m_Density * trnglsCount / volume);
+		for (size_t axis = 0; axis < 3; axis++) {
+			m_Res[axis] = std::clamp<size_t>(static_cast<size_t>(diag.At(axis) * cellsPerUnit), 1, m_MaxRes);
+			m_CellSize[axis] = diag.At(axis) / m_Res[axis];
+		}
+
+		m_vecCellStart.assign(m_Res[0] * m_Res[1] * m_Res[2] + 1, 0);
+		ForEachOverlap(pts, trngls, [&](size_t cell, size_t) { m_vecCellStart[cell + 1]++; });
+
+		for (size_t i = 1; i < m_vecCellStart.size(); i++) {
+			m_vecCellStart[i] += m_vecCellStart[i - 1];
+		}
+
+		m_vecCellTrngls.resize(m_vecCellStart.back());
+		std::vector<uint32_t> fill(m_vecCellStart.begin(), m_vecCellStart.end() - 1);
+		ForEachOverlap(pts, trngls, [&](size_t cell, size_t trngl) {
+			m_vecCellTrngls[fill[cell]++] = static_cast<uint32_t>(trngl);
+		});
+
+		TIMER_END("build uniform grid");
+	}
+
+	using LibAccel<T, I>::IsIntersectionRay;
+
+	// the walk starts at the cell containing tMin and ends at tMax
+	bool IsIntersectionRay(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMin, T tMax, T& dist, size_t& ind,
+		const LibCancelToken* token) const override {
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		dist = tMax;
+		bool isFound = false;
+		bool isCancelled = false;
+		size_t visited = 0;
+		Walk(ray.Origin(), dir, tMin, tMax, [&](size_t cellInd, T tCellExit) {
+			if (token && visited++ % LibAccel<T, I>::m_CancelPoll == 0 && token->IsCancelled()) {
+				isCancelled = true;
+				return true;
+			}
+			for (uint32_t i = m_vecCellStart[cellInd]; i < m_vecCellStart[cellInd + 1]; i++) {
+				size_t trngl = m_vecCellTrngls[i];
+				T curDist;
+				if (mdl.IsIntersectionTrngl(ray.Origin(), dir, trngl, curDist) && curDist >= tMin &&
+					(curDist < dist || (isFound && curDist == dist && trngl < ind))) {
+					dist = curDist;
+					ind = trngl;
+					isFound = true;
+				}
+			}
+			return isFound && dist <= tCellExit;
+		});
+		return isFound && !isCancelled;
+	}
+
+	bool IsOccluded(const LibModel<T, I>& mdl, const LibRay<T>& ray, T tMax) const override {
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		bool isOccluded = false;
+		Walk(ray.Origin(), dir, 0, tMax, [&](size_t cellInd, T) {
+			for (uint32_t i = m_vecCellStart[cellInd]; i < m_vecCellStart[cellInd + 1]; i++) {
+				T dist;
+				if (mdl.IsIntersectionTrngl(ray.Origin(), dir, m_vecCellTrngls[i], dist) && dist < tMax) {
+					isOccluded = true;
+					return true;
+				}
+			}
+			return false;
+		});
+		return isOccluded;
+	}
+
+	// a triangle spanning several cells is reported once per cell
+	void IntersectAll(const LibModel<T, I>& mdl, const LibRay<T>& ray, std::vector<LibHit<T>>& hits) const override {
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		Walk(ray.Origin(), dir, 0, std::numeric_limits<T>::max(), [&](size_t cellInd, T) {
+			for (uint32_t i = m_vecCellStart[cellInd]; i < m_vecCellStart[cellInd + 1]; i++) {
+				LibHit<T> hit;
+				hit.m_trngl = m_vecCellTrngls[i];
+				if (mdl.IsIntersectionTrngl(ray.Origin(), dir, hit.m_trngl, hit.m_dist, hit.m_u, hit.m_v)) {
+					hits.push_back(hit);
+				}
+			}
+			return false;
+		});
+	}
+
+private:
+	// 3D-DDA over the cells pierced by the ray in [tMin, tMax], visit(cell, tCellExit) returns true to stop
+	template<typename Visit>
+	void Walk(const LibPoint<T>& org, const LibVector<T>& dir, T tMin, T tMax, Visit visit) const {
+		if (IsEmpty()) {
+			return;
+		}
+
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+
+		T tEnter, tExit;
+		if (!m_box.IsIntersectionRay(org, dirInv, tMin, tMax, tEnter, tExit)) {
+			return;
+		}
+
+		LibPoint<T> ptEnter = org + dir * tEnter;
+		int64_t cell[3], step[3], res[3];
+		T tNext[3], tDelta[3];
+		for (size_t axis = 0; axis < 3; axis++) {
+			res[axis] = static_cast<int64_t>(m_Res[axis]);
+			cell[axis] = std::clamp<int64_t>(static_cast<int64_t>(
+				(ptEnter.At(axis) - m_box.Min().At(axis)) / m_CellSize[axis]), 0, res[axis] - 1);
+
+			if (dir.At(axis) == 0) {
+				step[axis] = 0;
+				tNext[axis] = std::numeric_limits<T>::max();
+				tDelta[axis] = std::numeric_limits<T>::max();
+				continue;
+			}
+
+			step[axis] = dir.At(axis) > 0 ? 1 : -1;
+			T bound = m_box.Min().At(axis) + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * m_CellSize[axis];
+			tNext[axis] = (bound - org.At(axis)) * dirInv[axis];
+			tDelta[axis] = m_CellSize[axis] * std::fabs(dirInv[axis]);
+		}
+
+		while (true) {
+			size_t axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+			size_t cellInd = (cell[2] * res[1] + cell[1]) * res[0] + cell[0];
+			if (visit(cellInd, tNext[axis]) || tNext[axis] > tExit) {
+				break;
+			}
+
+			cell[axis] += step[axis];
+			if (cell[axis] < 0 || cell[axis] >= res[axis]) {
+				break;
+			}
+			tNext[axis] += tDelta[axis];
+		}
+	}
+
+	template<typename Func>
+	void ForEachOverlap(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, Func func) const {
+		LibVector<T> halfSize(m_CellSize[0] / 2 + m_Pad, m_CellSize[1] / 2 + m_Pad, m_CellSize[2] / 2 + m_Pad);
+		for (size_t trngl = 0; trngl < trngls.size() / 3; trngl++) {
+			const LibPoint<T>& A = pts[trngls[3 * trngl]];
+			const LibPoint<T>& B = pts[trngls[3 * trngl + 1]];
+			const LibPoint<T>& C = pts[trngls[3 * trngl + 2]];
+
+			LibAABB<T> box;
+			box.Extend(A).Extend(B).Extend(C).Inflate(m_Pad);
+
+			size_t cellMin[3], cellMax[3];
+			for (size_t axis = 0; axis < 3; axis++) {
+				cellMin[axis] = CellCoord(box.Min().At(axis), axis);
+				cellMax[axis] = CellCoord(box.Max().At(axis), axis);
+			}
+
+			for (size_t z = cellMin[2]; z <= cellMax[2]; z++) {
+				for (size_t y = cellMin[1]; y <= cellMax[1]; y++) {
+					for (size_t x = cellMin[0]; x <= cellMax[0]; x++) {
+						LibPoint<T> center(m_box.Min().X() + (x + T(0.5)) * m_CellSize[0],
+							m_box.Min().Y() + (y + T(0.5)) * m_CellSize[1],
+							m_box.Min().Z() + (z + T(0.5)) * m_CellSize[2]);
+						if (IsTrnglOverlapBox(A - center, B - center, C - center, halfSize)) {
+							func((z * m_Res[1] + y) * m_Res[0] + x, trngl);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	size_t CellCoord(T coord, size_t axis) const {
+		T cell = (coord - m_box.Min().At(axis)) / m_CellSize[axis];
+		return std::clamp<size_t>(static_cast<size_t>(std::max<T>(cell, 0)), 0, m_Res[axis] - 1);
+	}
+
+	// separating axis test of a triangle given relative to the box center
+	static bool IsTrnglOverlapBox(const LibVector<T>& A, const LibVector<T>& B, const LibVector<T>& C,
+		const LibVector<T>& halfSize) {
+		const LibVector<T> edges[3] = { B - A, C - B, A - C };
+		const LibVector<T> units[3] = { LibVector<T>(1, 0, 0), LibVector<T>(0, 1, 0), LibVector<T>(0, 0, 1) };
+
+		for (const LibVector<T>& unit : units) {
+			for (const LibVector<T>& edge : edges) {
+				LibVector<T> axis = unit.CrossProduct(edge);
+				if (IsSeparated(axis, A, B, C, halfSize)) {
+					return false;
+				}
+			}
+		}
+
+		return !IsSeparated(edges[0].CrossProduct(edges[1]), A, B, C, halfSize);
+	}
+
+	static bool IsSeparated(const LibVector<T>& axis, const LibVector<T>& A, const LibVector<T>& B,
+		const LibVector<T>& C, const LibVector<T>& halfSize) {
+		T pA = axis.DotProduct(A);
+		T pB = axis.DotProduct(B);
+		T pC = axis.DotProduct(C);
+		T radius = halfSize.X() * std::fabs(axis.X()) + halfSize.Y() * std::fabs(axis.Y()) +
+			halfSize.Z() * std::fabs(axis.Z());
+		return std::min({ pA, pB, pC }) > radius || std::max({ pA, pB, pC }) < -radius;
+	}
+
+	LibAABB<T> m_box;
+	size_t m_Res[3] = { 0, 0, 0 };
+	T m_CellSize[3] = { 0, 0, 0 };
+	T m_Pad = 0;
+
+	std::vector<uint32_t> m_vecCellStart;
+	std::vector<uint32_t> m_vecCellTrngls;
+
+	static constexpr T m_Density = 2;
+	static constexpr T m_MinRelExtent = T(1e-3);
+	static constexpr size_t m_MaxRes = 512;
+};
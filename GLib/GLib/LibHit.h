@@ -0,0 +1,15 @@
+#pragma once
+
+#include "LibPoint.h"
+
+// one ray/triangle crossing, m_u and m_v weight the second and third vertex of the triangle
+template<typename T>
+struct LibHit {
+	bool m_isHit = false;
+	T m_dist = 0;
+	size_t m_trngl = 0;
+	int m_srfc = -1;
+	T m_u = 0;
+	T m_v = 0;
+	LibPoint<T> m_pt;
+};
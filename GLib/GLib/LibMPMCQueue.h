@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+// bounded lock-free multi-producer/multi-consumer ring (Vyukov). Every cell carries a sequence number:
+// it equals the position when the cell is free for that position and position + 1 once filled.
+// Capacity is rounded up to a power of two, T should be cheap to copy (pointers, indices)
+template<typename T>
+class LibMPMCQueue {
+public:
+	explicit LibMPMCQueue(size_t capacity) {
+		size_t size = 2;
+		while (size < capacity) {
+			size *= 2;
+		}
+		m_mask = size - 1;
+		m_vecCells = std::vector<Cell>(size);
+		for (size_t i = 0; i < size; i++) {
+			m_vecCells[i].m_seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	LibMPMCQueue(const LibMPMCQueue&) = delete;
+	LibMPMCQueue& operator=(const LibMPMCQueue&) = delete;
+
+	inline size_t Capacity() const {
+		return m_mask + 1;
+	}
+
+	// false if the queue is full
+	bool TryPush(const T& val) {
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = m_vecCells[pos & m_mask];
+			size_t seq = cell.m_seq.load(std::memory_order_acquire);
+			ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+			if (diff == 0) {
+				if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.m_val = val;
+					cell.m_seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// false if the queue is empty
+	bool TryPop(T& val) {
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		while (true) {
+			Cell& cell = m_vecCells[pos & m_mask];
+			size_t seq = cell.m_seq.load(std::memory_order_acquire);
+			ptrdiff_t diff = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos + 1);
+			if (diff == 0) {
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					val = cell.m_val;
+					cell.m_seq.store(pos + m_mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> m_seq;
+		T m_val;
+	};
+
+	std::vector<Cell> m_vecCells;
+	size_t m_mask = 0;
+
+	// producers and consumers spin on different cache lines
+	alignas(64) std::atomic<size_t> m_tail = 0;
+	alignas(64) std::atomic<size_t> m_head = 0;
+};
@@ -1,20 +1,37 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <thread>
+#include <memory>
+#include <span>
 #include "LibPoint.h"
 #include "LibVector.h"
-#include "LibTriangle.h"
+#include "LibTrnglKernel.h"
+#include "LibTrnglCache.h"
 #include "LibRay.h"
+#include "LibSegment.h"
 #include "LibTimer.h"
 #include "LibThreadPool.h"
+#include "LibParallel.h"
+#include "LibCancelToken.h"
+#include "LibAABB.h"
+#include "LibCoordArray.h"
 #include "LibMatrix.h"
 #include "LibCylinder.h"
+#include "LibHit.h"
+#include "LibRayPacket.h"
+#include "LibAccel.h"
+#include "LibBVH.h"
+#include "LibGrid.h"
 
-template<typename T>
+template<typename T, typename I = uint32_t>
 class LibModel
 {
 public:
+	// vertex index type, 32 bits unless a model has more vertices than that
+	using Index = I;
+
 	class Surface
 	{
 	public:
@@ -57,9 +74,14 @@ public:
 	LibModel() = default;
 
 	LibModel(const std::vector<LibPoint<T>>& pts, const std::vector<LibVector<T>>& normals,
-		const std::vector<size_t>& triangles, const std::vector<Surface>& surfaces) :
+		const std::vector<I>& triangles, const std::vector<Surface>& surfaces) :
 		m_vecPoints(pts), m_vecNormals(normals), m_vecTriangles(triangles), m_vecSurfaces(surfaces) {}
 
+	LibModel(const LibModel&) = default;
+	LibModel(LibModel&&) = default;
+	LibModel& operator=(const LibModel&) = default;
+	LibModel& operator=(LibModel&&) = default;
+
 	~LibModel() = default;
 
 	inline size_t TrinaglesNum() const { return m_vecTriangles.size() / 3; }
@@ -92,7 +114,7 @@ public:
 		return m_vecNormals;
 	}
 
-	inline const std::vector<size_t>& Triangles() const
+	inline const std::vector<I>& Triangles() const
 	{
 		return m_vecTriangles;
 	}
@@ -102,19 +124,95 @@ public:
 		return m_vecSurfaces;
 	}
 
+	// points are stored relative to the origin, which stays double: a float model of a large assembly keeps
+	// float precision around the origin instead of losing it to the size of the coordinates
+	inline const LibVector<double>& Origin() const
+	{
+		return m_origin;
+	}
+
+	inline LibPoint<double> ToWorld(const LibPoint<T>& pt) const
+	{
+		return LibPoint<double>(pt.X() + m_origin.X(), pt.Y() + m_origin.Y(), pt.Z() + m_origin.Z());
+	}
+
+	inline LibPoint<T> ToLocal(const LibPoint<double>& pt) const
+	{
+		return LibPoint<T>(static_cast<T>(pt.X() - m_origin.X()), static_cast<T>(pt.Y() - m_origin.Y()),
+			static_cast<T>(pt.Z() - m_origin.Z()));
+	}
+
+	// copy of mdl in this precision with points relative to origin, e.g. a LibModel<float> of a double
+	// model around the centre of its bounding box. The accelerator is not copied
+	template<typename U, typename J>
+	static LibModel Recentered(const LibModel<U, J>& mdl, const LibPoint<double>& origin)
+	{
+		LibModel res;
+		res.m_origin = origin.AsVector();
+		res.m_vecPoints.reserve(mdl.Points().size());
+		for (const LibPoint<U>& pt : mdl.Points()) {
+			res.m_vecPoints.push_back(res.ToLocal(mdl.ToWorld(pt)));
+		}
+		res.m_vecNormals.reserve(mdl.Normals().size());
+		for (const LibVector<U>& nrml : mdl.Normals()) {
+			res.m_vecNormals.push_back(LibVector<T>(static_cast<T>(nrml.X()), static_cast<T>(nrml.Y()),
+				static_cast<T>(nrml.Z())));
+		}
+		res.m_vecTriangles.assign(mdl.Triangles().begin(), mdl.Triangles().end());
+		for (const typename LibModel<U, J>::Surface& srfc : mdl.Surfaces()) {
+			res.m_vecSurfaces.push_back(Surface(srfc.Begin(), srfc.End()));
+		}
+		return res;
+	}
+
+	// SoA keeps X/Y/Z arrays of points and normals next to the vectors, in sync with them
+	enum class Layout {
+		AoS,
+		SoA
+	};
+
+	inline Layout GetLayout() const
+	{
+		return m_layout;
+	}
+
+	void SetLayout(Layout layout)
+	{
+		m_layout = layout;
+		SyncPointsSoA();
+		SyncNormalsSoA();
+	}
+
+	// empty unless the layout is SoA
+	inline const LibCoordArray<T>& PointsSoA() const
+	{
+		return m_soaPoints;
+	}
+
+	inline const LibCoordArray<T>& NormalsSoA() const
+	{
+		return m_soaNormals;
+	}
+
 	inline void SetPoints(const std::vector<LibPoint<T>>& pts)
 	{
 		m_vecPoints = pts;
+		SyncPointsSoA();
+		m_accel.reset();
+		m_trnglCache.Reset();
 	}
 
 	inline void SetNormals(const std::vector<LibVector<T>>& nrmls)
 	{
 		m_vecNormals = nrmls;
+		SyncNormalsSoA();
 	}
 
-	inline void SetTriangles(const std::vector<size_t>& trngls)
+	inline void SetTriangles(const std::vector<I>& trngls)
 	{
 		m_vecTriangles = trngls;
+		m_accel.reset();
+		m_trnglCache.Reset();
 	}
 
 	inline void SetSurfaces(const std::vector<Surface>& srfc)
@@ -122,16 +220,22 @@ public:
 		m_vecSurfaces = srfc;
 	}
 
-	inline void SetModel(const LibModel<T> mdl) {
+	inline void SetModel(const LibModel& mdl) {
+		if (this == &mdl) {
+			return;
+		}
 		Clear();
 		SetPoints(mdl.Points());
 		SetNormals(mdl.Normals());
 		SetTriangles(mdl.Triangles());
 		SetSurfaces(mdl.Surfaces());
+		m_origin = mdl.m_origin;
 	}
 
-	bool operator==(const LibModel<T>& other) const {
-		return Points() == other.Points() && Normals() == other.Normals() &&
+	bool operator==(const LibModel& other) const {
+		// the origin is compared exactly, LibVector::operator== only checks parallel vectors of equal length
+		return m_origin.X() == other.m_origin.X() && m_origin.Y() == other.m_origin.Y() && m_origin.Z() == other.m_origin.Z() &&
+			Points() == other.Points() && Normals() == other.Normals() &&
 			Triangles() == other.Triangles() && Surfaces() == other.Surfaces();
 	}
 
@@ -140,38 +244,125 @@ public:
 		m_vecNormals.clear();
 		m_vecTriangles.clear();
 		m_vecSurfaces.clear();
+		m_origin = LibVector<double>();
+		m_soaPoints.Clear();
+		m_soaNormals.Clear();
+		m_accel.reset();
+		m_trnglCache.Reset();
+	}
+
+	LibAABB<T> BoundingBox() const {
+		if (m_layout == Layout::SoA) {
+			return m_soaPoints.BoundingBox(0, m_soaPoints.Size());
+		}
+		LibAABB<T> box;
+		for (const LibPoint<T>& pt : m_vecPoints) {
+			box.Extend(pt);
+		}
+		return box;
+	}
+
+	LibAABB<T> BoundingBox(LibThreadPool& tp) const {
+		return LibParallel::Reduce(tp, 0, m_vecPoints.size(), m_ParallelGrain, LibAABB<T>(),
+			[this](size_t first, size_t last) {
+				if (m_layout == Layout::SoA) {
+					return m_soaPoints.BoundingBox(first, last);
+				}
+				LibAABB<T> box;
+				for (size_t i = first; i < last; i++) {
+					box.Extend(m_vecPoints[i]);
+				}
+				return box;
+			},
+			[](LibAABB<T> box, const LibAABB<T>& other) { return box.Extend(other); });
 	}
 
 	LibVector<T> Diagonal() const {
-		LibPoint<T> minPoint = { std::numeric_limits<T>::max(), std::numeric_limits<T>::max(), std::numeric_limits<T>::max() };
-		LibPoint<T> maxPoint = { std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest(), std::numeric_limits<T>::lowest() };
+		LibAABB<T> box = BoundingBox();
+		return box.IsEmpty() ? LibVector<T>() : box.Diagonal();
+	}
 
-		for (const auto& point : Points()) {
-			if (point.X() < minPoint.X()) {
-				minPoint.SetX(point.X());
-			}
-			if (point.Y() < minPoint.Y()) {
-				minPoint.SetY(point.Y());
-			}
-			if (point.Z() < minPoint.Z()) {
-				minPoint.SetZ(point.Z());
-			}
+	// area weighted vertex normals. Face normals are computed first, then every vertex sums the faces
+	// around it through a vertex to triangle map, so no two tasks write the same normal
+	void ComputeNormals(LibThreadPool& tp) {
+		TIMER_START("compute normals");
+		const size_t trnglsCount = TrinaglesNum();
+		std::vector<LibVector<T>> faceNormals(trnglsCount);
+		LibParallel::ForEach(tp, 0, trnglsCount, m_ParallelGrain, [&](size_t i) {
+			const LibPoint<T>& A = GetPtInTrngl(i, 0);
+			faceNormals[i] = (GetPtInTrngl(i, 1) - A).CrossProduct(GetPtInTrngl(i, 2) - A);
+		});
+
+		std::vector<size_t> start(m_vecPoints.size() + 1, 0);
+		for (size_t idx : m_vecTriangles) {
+			start[idx + 1]++;
+		}
+		for (size_t i = 1; i < start.size(); i++) {
+			start[i] += start[i - 1];
+		}
+		std::vector<size_t> vtxTrngls(m_vecTriangles.size());
+		std::vector<size_t> fill(start.begin(), start.end() - 1);
+		for (size_t i = 0; i < m_vecTriangles.size(); i++) {
+			vtxTrngls[fill[m_vecTriangles[i]]++] = i / 3;
+		}
 
-			if (point.X() > maxPoint.X()) {
-				maxPoint.SetX(point.X());
+		m_vecNormals.resize(m_vecPoints.size());
+		LibParallel::ForEach(tp, 0, m_vecPoints.size(), m_ParallelGrain, [&](size_t vtx) {
+			LibVector<T> nrml;
+			for (size_t i = start[vtx]; i < start[vtx + 1]; i++) {
+				nrml += faceNormals[vtxTrngls[i]];
 			}
-			if (point.Y() > maxPoint.Y()) {
-				maxPoint.SetY(point.Y());
-			}
-			if (point.Z() > maxPoint.Z()) {
-				maxPoint.SetZ(point.Z());
-			}
-		}
-		return maxPoint - minPoint;
-	};
+			m_vecNormals[vtx] = nrml.LengthVectorPow2() > 0 ? nrml.GetNormalize() : nrml;
+		});
+		SyncNormalsSoA();
+		TIMER_END("compute normals");
+	}
+
+	void BuildBVH() {
+		std::shared_ptr<LibBVH<T, I>> bvh = std::make_shared<LibBVH<T, I>>();
+		bvh->Build(m_vecPoints, m_vecTriangles);
+		m_accel = bvh;
+	}
 
+	void BuildBVH(LibThreadPool& tp) {
+		std::shared_ptr<LibBVH<T, I>> bvh = std::make_shared<LibBVH<T, I>>();
+		bvh->BuildLBVH(m_vecPoints, m_vecTriangles, tp);
+		m_accel = bvh;
+	}
+
+	void BuildGrid() {
+		std::shared_ptr<LibGrid<T, I>> grid = std::make_shared<LibGrid<T, I>>();
+		grid->Build(m_vecPoints, m_vecTriangles);
+		m_accel = grid;
+	}
+
+	inline void SetAccel(const std::shared_ptr<const LibAccel<T, I>>& accel) {
+		m_accel = accel;
+	}
+
+	inline const LibAccel<T, I>* Accel() const {
+		return m_accel.get();
+	}
+
+	// first vertex and edges of every triangle, built on the first brute force query
+	std::shared_ptr<const LibTrnglCache<T>> TrnglCache() const {
+		return m_trnglCache.Get([this]() {
+			std::shared_ptr<LibTrnglCache<T>> cache = std::make_shared<LibTrnglCache<T>>();
+			cache->Build(m_vecPoints, m_vecTriangles);
+			return cache;
+		});
+	}
 
-	static LibModel<T> CreateCube(const LibPoint<T>& center, T length)
+	// built on tp in the chunks the parallel queries use, see LibTrnglCache::Build
+	std::shared_ptr<const LibTrnglCache<T>> TrnglCache(LibThreadPool& tp) const {
+		return m_trnglCache.Get([this, &tp]() {
+			std::shared_ptr<LibTrnglCache<T>> cache = std::make_shared<LibTrnglCache<T>>();
+			cache->Build(m_vecPoints, m_vecTriangles, tp, m_ParallelGrain);
+			return cache;
+		});
+	}
+
+	static LibModel CreateCube(const LibPoint<T>& center, T length)
 	{
 		T x = center.X(); T y = center.Y(); T z = center.Z();
 		T halfLen = length / 2;
@@ -206,29 +397,29 @@ public:
 		std::vector<Surface> vecSurfaces = {Surface(0, 2), Surface(2, 4), Surface(4, 6),
 						Surface(6, 8), Surface(8, 10),Surface(10, 12) };
 
-		std::vector<size_t> vecTriangles;
+		std::vector<I> vecTriangles;
 		vecTriangles.resize(6 * 2 * 3);
 		int ind = 0;
 		for (size_t i = 0; i < vecPoints.size(); i += 4)
 		{
-			vecTriangles[ind++] = i;
-			vecTriangles[ind++] = i + 1;
-			vecTriangles[ind++] = i + 2;
+			vecTriangles[ind++] = static_cast<I>(i);
+			vecTriangles[ind++] = static_cast<I>(i + 1);
+			vecTriangles[ind++] = static_cast<I>(i + 2);
 
-			vecTriangles[ind++] = i;
-			vecTriangles[ind++] = i + 2;
-			vecTriangles[ind++] = i + 3;
+			vecTriangles[ind++] = static_cast<I>(i);
+			vecTriangles[ind++] = static_cast<I>(i + 2);
+			vecTriangles[ind++] = static_cast<I>(i + 3);
 		}
 
-		LibModel<T> model(vecPoints, vecNormals, vecTriangles, vecSurfaces);
+		LibModel model(vecPoints, vecNormals, vecTriangles, vecSurfaces);
 		return model;
 	}
 
-	static LibModel<T> CreateCylinder(const LibPoint<T>& pt_Origin,
+	static LibModel CreateCylinder(const LibPoint<T>& pt_Origin,
 		const LibVector<T>& vec_Direction, T Radius, T Height, T ChordTolerance) {
 		std::vector<LibPoint<T>> vecPoints;
 		std::vector<LibVector<T>> vecNormals;
-		std::vector<size_t> vecTriangles;
+		std::vector<I> vecTriangles;
 		std::vector<Surface> vecSurfaces;
 
 		T angle = std::acos((Radius - ChordTolerance) / Radius) * 2;
@@ -266,51 +457,48 @@ public:
 			vecNormals.push_back(normal2);
 			vecNormals.push_back(normal1);
 
-			vecTriangles.push_back(i);
-			vecTriangles.push_back(i % pntsCountOnCrcl + 1);
-			vecTriangles.push_back(i % pntsCountOnCrcl + pntsCountOnCrcl + 2);
+			vecTriangles.push_back(static_cast<I>(i));
+			vecTriangles.push_back(static_cast<I>(i % pntsCountOnCrcl + 1));
+			vecTriangles.push_back(static_cast<I>(i % pntsCountOnCrcl + pntsCountOnCrcl + 2));
 
-			vecTriangles.push_back(i);
-			vecTriangles.push_back(i % pntsCountOnCrcl + pntsCountOnCrcl + 2);
-			vecTriangles.push_back(i + pntsCountOnCrcl + 1);
+			vecTriangles.push_back(static_cast<I>(i));
+			vecTriangles.push_back(static_cast<I>(i % pntsCountOnCrcl + pntsCountOnCrcl + 2));
+			vecTriangles.push_back(static_cast<I>(i + pntsCountOnCrcl + 1));
 		}
 		vecSurfaces.push_back(Surface(trnglCount, vecTriangles.size() / 3));
 
-		LibModel<T> model(vecPoints, vecNormals, vecTriangles, vecSurfaces);
+		LibModel model(vecPoints, vecNormals, vecTriangles, vecSurfaces);
 		return model;
 	}
 
+	bool IsIntersectionTrngl(const LibRay<T>& ray, size_t idxTriangle, T& dist) const {
+		return IsIntersectionTrngl(ray.Origin(), ray.Direction().GetNormalize(), idxTriangle, dist);
+	}
+
+	// dir must be normalized, accelerators normalize it once per query
+	bool IsIntersectionTrngl(const LibPoint<T>& org, const LibVector<T>& dir, size_t idxTriangle, T& dist) const {
+		T u, v;
+		return IsIntersectionTrngl(org, dir, idxTriangle, dist, u, v);
+	}
+
+	bool IsIntersectionTrngl(const LibPoint<T>& org, const LibVector<T>& dir, size_t idxTriangle, T& dist, T& u, T& v) const {
+		return LibTrnglKernel<T>::IsIntersection(org, dir, GetPtInTrngl(idxTriangle, 0),
+			GetPtInTrngl(idxTriangle, 1), GetPtInTrngl(idxTriangle, 2), dist, u, v);
+	}
+
 	bool IsIntersectionRay(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc) const {
 		TIMER_START("intersection of model and ray");
 
-		T dist = DBL_MAX;
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		T dist = std::numeric_limits<T>::max();
 		size_t ind = 0;
-		for (size_t i = 0; i < m_vecTriangles.size(); i += 3) {
-			LibTriangle<T> trngl(m_vecPoints[m_vecTriangles[i]],
-				m_vecPoints[m_vecTriangles[i + 1]],
-				m_vecPoints[m_vecTriangles[i + 2]]);
-
-			LibPoint<T> IntersPt;
-			if (trngl.IsIntersectionLine(ray, IntersPt)) {
-				if (!ray.IsPointOnLine(IntersPt)) {
-					continue;
-				}
-
-				T curDist = IntersPt.DistanceTo(ray.Origin());
-				if (curDist < dist) {
-					dist = curDist;
-					ind = i / 3;
-				}
-			}
-		}
-
-		if (dist == DBL_MAX) {
+		if (!TrnglCache()->IsIntersectionRange(ray.Origin(), dir, 0, TrinaglesNum(), dist, ind)) {
 
 			TIMER_END("intersection of model and ray");
 			return false;
 		}
 
-		pt = ray.Origin() + dist * ray.Direction().GetNormalize();
+		pt = ray.Origin() + dist * dir;
 		srfc = FindSurfForTrngl(ind);
 		
 		TIMER_END("intersection of model and ray");
@@ -318,114 +506,251 @@ public:
 		return true;
 	}
 
-	bool IsIntersectionRayThread(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc) const {
-		TIMER_START("intersection with thread of model and ray");
+	bool IsIntersectionRay(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc, const LibAccel<T, I>& accel) const {
+		TIMER_START("intersection of model and ray with accelerator");
 
-		auto processTriangles = [&](size_t trnglIndex, size_t count, T& minDist, size_t& minInd) {
-			size_t startIndex = trnglIndex * 3;
-			size_t endIndex = startIndex + count * 3;
-			for (size_t i = startIndex; i < endIndex; i += 3) {
-				LibTriangle<T> trngl(m_vecPoints[m_vecTriangles[i]],
-					m_vecPoints[m_vecTriangles[i + 1]],
-					m_vecPoints[m_vecTriangles[i + 2]]);
-
-				LibPoint<T> localIntersPt;
-				if (trngl.IsIntersectionLine(ray, localIntersPt)) {
-					if (!ray.IsPointOnLine(localIntersPt)) {
-						continue;
-					}
-
-					T curDist = localIntersPt.DistanceTo(ray.Origin());
-
-					if (curDist < minDist) {
-						minDist = curDist;
-						minInd = i / 3;
-					}
-				}
-			}
-		};
+		T dist;
+		size_t ind = 0;
+		if (!accel.IsIntersectionRay(*this, ray, dist, ind)) {
+			TIMER_END("intersection of model and ray with accelerator");
+			return false;
+		}
 
-		const size_t numThreads = std::thread::hardware_concurrency();
+		pt = ray.Origin() + dist * ray.Direction().GetNormalize();
+		srfc = FindSurfForTrngl(ind);
 
-		std::vector<std::thread> threads;
-		std::vector<T> minDists(numThreads, DBL_MAX);
-		std::vector<size_t> minInd(numThreads, 0);
+		TIMER_END("intersection of model and ray with accelerator");
 
-		const size_t trnglsCount = Triangles().size() / 3;
-		std::vector<size_t> trnglsForThread(numThreads, trnglsCount / numThreads);
-		const size_t trnglsRemainder = trnglsCount % numThreads;
+		return true;
+	}
+
+	// closest hit in [tMin, tMax) along the normalized direction, through the accelerator if one is built.
+	// The search bound starts at tMax and shrinks with every hit
+	bool IsIntersectionRay(const LibRay<T>& ray, T tMin, T tMax, LibHit<T>& hit) const {
+		TIMER_START("interval intersection of model and ray");
+		LibCancelToken token;
+		IsIntersectionRay(ray, tMin, tMax, hit, token);
+		TIMER_END("interval intersection of model and ray");
+		return hit.m_isHit;
+	}
 
-		for (size_t i = 0; i < trnglsRemainder; ++i) {
-			trnglsForThread[i]++;
+	// interval query that can be called off from another thread: the token is polled between blocks of
+	// m_CancelBlock triangles, or by the accelerator while it walks its nodes or cells.
+	// Returns no hit once cancelled. Runs without timers so it is safe to call from pool threads
+	bool IsIntersectionRay(const LibRay<T>& ray, T tMin, T tMax, LibHit<T>& hit, const LibCancelToken& token) const {
+		hit.m_isHit = false;
+		if (token.IsCancelled()) {
+			return false;
 		}
 
-		size_t startInd = 0;
-		for (size_t t = 0; t < numThreads; ++t) {
-			size_t count = trnglsForThread[t];
-			threads.emplace_back(processTriangles, startInd, count, std::ref(minDists[t]), std::ref(minInd[t]));
-			startInd += count;
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		T dist = tMax;
+		size_t ind = 0;
+		bool isFound = false;
+		if (m_accel) {
+			isFound = m_accel->IsIntersectionRay(*this, ray, tMin, tMax, dist, ind, &token);
+		}
+		else {
+			std::shared_ptr<const LibTrnglCache<T>> cache = TrnglCache();
+			for (size_t first = 0; first < TrinaglesNum(); first += m_CancelBlock) {
+				if (token.IsCancelled()) {
+					return false;
+				}
+				size_t last = std::min(first + m_CancelBlock, TrinaglesNum());
+				isFound = cache->IsIntersectionRange(ray.Origin(), dir, first, last, tMin, dist, ind) || isFound;
+			}
 		}
 
-		for (auto& thread : threads) {
-			thread.join();
+		if (isFound) {
+			hit.m_isHit = true;
+			FillHit(ray.Origin(), dir, dist, ind, hit);
 		}
+		return isFound;
+	}
 
-		T minDist = minDists[0];
-		size_t ind = 0;
-		for (size_t i = 1; i < numThreads; i++)
-		{
-			if (minDists[i] < minDist) {
-				minDist = minDists[i];
-				ind = minInd[i];
+	// query on a ray in world coordinates: the search runs in T on the ray moved to the origin, then the
+	// triangle found is intersected again in double, so the pick point does not carry the error of T
+	bool PickWorld(const LibRay<double>& ray, double tMin, double tMax, LibHit<double>& hit,
+		const LibCancelToken& token) const {
+		hit.m_isHit = false;
+		const LibVector<double> dir = ray.Direction().GetNormalize();
+		const LibRay<T> local(ToLocal(ray.Origin()), LibVector<T>(static_cast<T>(dir.X()),
+			static_cast<T>(dir.Y()), static_cast<T>(dir.Z())));
+		LibHit<T> localHit;
+		if (!IsIntersectionRay(local, static_cast<T>(tMin), static_cast<T>(tMax), localHit, token)) {
+			return false;
+		}
+
+		hit.m_isHit = true;
+		hit.m_trngl = localHit.m_trngl;
+		hit.m_srfc = localHit.m_srfc;
+		hit.m_dist = localHit.m_dist;
+		hit.m_u = localHit.m_u;
+		hit.m_v = localHit.m_v;
+		double dist, u, v;
+		if (LibTrnglKernel<double>::IsIntersection(ray.Origin(), dir, ToWorld(GetPtInTrngl(hit.m_trngl, 0)),
+			ToWorld(GetPtInTrngl(hit.m_trngl, 1)), ToWorld(GetPtInTrngl(hit.m_trngl, 2)), dist, u, v)) {
+			// a grazing hit T found may miss in double, it keeps the distance of T then
+			hit.m_dist = dist;
+			hit.m_u = u;
+			hit.m_v = v;
+		}
+		hit.m_pt = ray.Origin() + hit.m_dist * dir;
+		return true;
+	}
+
+	// closest hit in [0, length) from the segment origin, nothing past the end point is tested
+	bool IsIntersectionSegment(const LibSegment<T>& sgmnt, LibHit<T>& hit) const {
+		return IsIntersectionRay(LibRay<T>(sgmnt.Origin(), sgmnt.Direction()), 0, sgmnt.Length(), hit);
+	}
+
+	// closest hits of many rays at once: rays are grouped by direction octant into SIMD packets
+	// and traced through the accelerator if one is built, otherwise against every triangle
+	void IntersectRays(std::span<const LibRay<T>> rays, std::span<LibHit<T>> hits) const {
+		TIMER_START("intersection of model and ray packets");
+		using Packet = LibRayPacket<T>;
+		const size_t count = std::min(rays.size(), hits.size());
+
+		std::vector<size_t> order;
+		Packet::OrderByOctant(rays, count, order);
+
+		for (size_t first = 0; first < count; first += Packet::Size) {
+			const size_t packCount = std::min(Packet::Size, count - first);
+			const LibRay<T>* packRays[Packet::Size];
+			for (size_t lane = 0; lane < packCount; lane++) {
+				packRays[lane] = &rays[order[first + lane]];
+			}
+
+			Packet packet(packRays, packCount);
+			T dist[Packet::Size];
+			size_t ind[Packet::Size] = {};
+			if (m_accel) {
+				m_accel->IsIntersectionPacket(*this, packet, dist, ind);
+			}
+			else {
+				IsIntersectionPacket(packet, dist, ind);
+			}
+
+			for (size_t lane = 0; lane < packCount; lane++) {
+				LibHit<T>& hit = hits[order[first + lane]];
+				hit.m_isHit = dist[lane] != std::numeric_limits<T>::max();
+				if (!hit.m_isHit) {
+					continue;
+				}
+				const LibRay<T>& ray = packet.Ray(lane);
+				FillHit(ray.Origin(), ray.Direction().GetNormalize(), dist[lane], ind[lane], hit);
 			}
 		}
 
-		if (minDist == DBL_MAX) {
-			TIMER_END("intersection with thread of model and ray");
-			return false;
+		TIMER_END("intersection of model and ray packets");
+	}
+
+	// every crossing of the ray sorted by distance, ties by triangle index. hits is cleared and refilled,
+	// so a buffer reused across calls stops allocating once it has grown to the largest result
+	size_t IntersectAll(const LibRay<T>& ray, std::vector<LibHit<T>>& hits) const {
+		TIMER_START("all intersections of model and ray");
+		hits.clear();
+
+		LibVector<T> dir = ray.Direction().GetNormalize();
+		if (m_accel) {
+			m_accel->IntersectAll(*this, ray, hits);
+		}
+		else {
+			TrnglCache()->ForEachHit(ray.Origin(), dir, 0, TrinaglesNum(), [&](size_t trngl, T dist, T u, T v) {
+				LibHit<T> hit;
+				hit.m_dist = dist;
+				hit.m_trngl = trngl;
+				hit.m_u = u;
+				hit.m_v = v;
+				hits.push_back(hit);
+			});
 		}
 
-		pt = ray.Origin() + minDist * ray.Direction().GetNormalize();
-		srfc = FindSurfForTrngl(ind);
-		TIMER_END("intersection with thread of model and ray");
+		std::sort(hits.begin(), hits.end(), [](const LibHit<T>& a, const LibHit<T>& b) {
+			return a.m_dist < b.m_dist || (a.m_dist == b.m_dist && a.m_trngl < b.m_trngl);
+		});
+		hits.erase(std::unique(hits.begin(), hits.end(), [](const LibHit<T>& a, const LibHit<T>& b) {
+			return a.m_trngl == b.m_trngl;
+		}), hits.end());
+
+		for (LibHit<T>& hit : hits) {
+			hit.m_isHit = true;
+			hit.m_srfc = FindSurfForTrngl(hit.m_trngl);
+			hit.m_pt = ray.Origin() + hit.m_dist * dir;
+		}
 
-		return true;
+		TIMER_END("all intersections of model and ray");
+		return hits.size();
 	}
 
-	bool IsIntersectionRayTP(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc,
-		LibThreadPool& tp) {
-		TIMER_START("intersection with ThreadPool of model and ray");
-		const size_t trnglsCount = Triangles().size() / 3;
+	// any hit in [0, tMax) along the ray, stops at the first triangle found
+	bool IsOccluded(const LibRay<T>& ray, T tMax) const {
+		TIMER_START("occlusion of model and ray");
 
-		size_t trnglsPerThread = static_cast<size_t>(trnglsCount * 0.01);
-		size_t trnglsRemainder = trnglsCount % trnglsPerThread;
+		bool isOccluded = m_accel ? m_accel->IsOccluded(*this, ray, tMax) :
+			TrnglCache()->IsOccludedRange(ray.Origin(), ray.Direction().GetNormalize(), 0, TrinaglesNum(), tMax);
 
-		size_t taskCnt = trnglsCount / trnglsPerThread;
-		T minDist = DBL_MAX;
-		size_t minInd = 0;
+		TIMER_END("occlusion of model and ray");
+		return isOccluded;
+	}
 
-		std::mutex mtx;
+	// any hit in [0, length) between the segment ends
+	bool IsOccluded(const LibSegment<T>& sgmnt) const {
+		return IsOccluded(LibRay<T>(sgmnt.Origin(), sgmnt.Direction()), sgmnt.Length());
+	}
 
-		size_t startInd = 0;
-		for (size_t i = 0; i < taskCnt; ++i) {
-			size_t count = trnglsPerThread + (i < trnglsRemainder ? 1 : 0);
-			tp.AddTask(std::make_unique<IntersectionTask>(*this, ray, startInd, count, minDist, minInd, mtx));
-			
-			startInd += count;
+	// occluded[i] is set to 1 if rays[i] hits the model in [0, tMax[i]); with an accelerator the rays are
+	// traced in packets, otherwise each ray streams the triangle cache and stops at its first hit
+	void IsOccluded(std::span<const LibRay<T>> rays, std::span<const T> tMax, std::span<uint8_t> occluded) const {
+		TIMER_START("occlusion of model and ray packets");
+		using Packet = LibRayPacket<T>;
+		const size_t count = std::min({ rays.size(), tMax.size(), occluded.size() });
+
+		if (!m_accel) {
+			std::shared_ptr<const LibTrnglCache<T>> cache = TrnglCache();
+			for (size_t i = 0; i < count; i++) {
+				occluded[i] = cache->IsOccludedRange(rays[i].Origin(), rays[i].Direction().GetNormalize(),
+					0, TrinaglesNum(), tMax[i]) ? 1 : 0;
+			}
+			TIMER_END("occlusion of model and ray packets");
+			return;
 		}
 
-		tp.WaitForFinish();
+		std::vector<size_t> order;
+		Packet::OrderByOctant(rays, count, order);
 
-		if (minDist == std::numeric_limits<T>::max()) {
-			TIMER_END("intersection with ThreadPool of model and ray");
-			return false;
+		for (size_t first = 0; first < count; first += Packet::Size) {
+			const size_t packCount = std::min(Packet::Size, count - first);
+			const LibRay<T>* packRays[Packet::Size];
+			T packMax[Packet::Size];
+			for (size_t lane = 0; lane < packCount; lane++) {
+				packRays[lane] = &rays[order[first + lane]];
+				packMax[lane] = tMax[order[first + lane]];
+			}
+
+			int bits = m_accel->IsOccludedPacket(*this, Packet(packRays, packCount), packMax);
+			for (size_t lane = 0; lane < packCount; lane++) {
+				occluded[order[first + lane]] = (bits >> lane) & 1;
+			}
 		}
 
-		pt = ray.Origin() + minDist * ray.Direction().GetNormalize();
-		srfc = FindSurfForTrngl(minInd);
-		TIMER_END("intersection with ThreadPool of model and ray");
+		TIMER_END("occlusion of model and ray packets");
+	}
 
-		return true;
+	// same chunked search as IsIntersectionRayTP, on the process-wide pool
+	bool IsIntersectionRayThread(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc) const {
+		TIMER_START("intersection with thread of model and ray");
+		bool isFound = IsIntersectionRayParallel(ray, pt, srfc, LibThreadPool::Shared());
+		TIMER_END("intersection with thread of model and ray");
+		return isFound;
+	}
+
+	bool IsIntersectionRayTP(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc,
+		LibThreadPool& tp) const {
+		TIMER_START("intersection with ThreadPool of model and ray");
+		bool isFound = IsIntersectionRayParallel(ray, pt, srfc, tp);
+		TIMER_END("intersection with ThreadPool of model and ray");
+		return isFound;
 	}
 
 	void Save(std::ostream& out) const {
@@ -433,18 +758,53 @@ public:
 
 		LibUtility::SaveVec(out, m_vecNormals);
 
-		LibUtility::SaveBuf(out, m_vecTriangles);
+		// indices are kept as size_t on disk, files do not depend on I
+		LibUtility::SaveBufAs<size_t>(out, m_vecTriangles);
 
 		LibUtility::SaveVec(out, m_vecSurfaces);
+
+		// optional section: the origin of the points, files of models at the zero origin do not have it
+		if (m_origin.X() != 0 || m_origin.Y() != 0 || m_origin.Z() != 0) {
+			LibUtility::Save(out, m_OriginTag);
+			LibUtility::Save(out, m_origin.X());
+			LibUtility::Save(out, m_origin.Y());
+			LibUtility::Save(out, m_origin.Z());
+		}
+
+		// optional section: the accelerator and the hash of the geometry it was built for
+		if (m_accel) {
+			LibUtility::Save(out, m_AccelTag);
+			LibUtility::Save(out, static_cast<uint32_t>(m_accel->GetType()));
+			LibUtility::Save(out, GeometryHash());
+			m_accel->Save(out);
+		}
 	}
 
-	void Load(std::istream& in) {
+	// false if the stream ends before the surfaces or an index does not fit in I, the model is empty then.
+	// Optional sections that can't be read are skipped
+	bool Load(std::istream& in) {
 		LibUtility::LoadVec(in, m_vecPoints);
 		LibUtility::LoadVec(in, m_vecNormals);
+		LibUtility::LoadBufAs<size_t>(in, m_vecTriangles);
+		LibUtility::LoadVec(in, m_vecSurfaces);
+		if (!in) {
+			Clear();
+			return false;
+		}
 
-		LibUtility::LoadBuf(in, m_vecTriangles);
+		SyncPointsSoA();
+		SyncNormalsSoA();
+		m_accel.reset();
+		m_trnglCache.Reset();
+		LoadOrigin(in);
+		LoadAccel(in);
+		return true;
+	}
 
-		LibUtility::LoadVec(in, m_vecSurfaces);
+	// points and triangle indices, a saved accelerator is reused only if this matches
+	uint64_t GeometryHash() const {
+		uint64_t hash = LibUtility::Hash(m_vecPoints.data(), m_vecPoints.size());
+		return LibUtility::HashAs<size_t>(m_vecTriangles, hash);
 	}
 	
 protected:
@@ -458,8 +818,108 @@ protected:
 		}
 	}
 
+	// reads the tag of an optional section, a stream without it is left where it was
+	static bool LoadTag(std::istream& in, uint32_t expTag) {
+		std::istream::pos_type pos = in.tellg();
+		uint32_t tag = 0;
+		LibUtility::Load(in, tag);
+		if (!in || tag != expTag) {
+			in.clear();
+			if (pos != std::istream::pos_type(-1)) {
+				in.seekg(pos);
+			}
+			return false;
+		}
+		return true;
+	}
+
+	void LoadOrigin(std::istream& in) {
+		m_origin = LibVector<double>();
+		if (LoadTag(in, m_OriginTag)) {
+			double x = 0, y = 0, z = 0;
+			LibUtility::Load(in, x);
+			LibUtility::Load(in, y);
+			LibUtility::Load(in, z);
+			m_origin = LibVector<double>(x, y, z);
+		}
+	}
+
+	// streams written before the accelerator section existed are left where the surfaces end
+	void LoadAccel(std::istream& in) {
+		if (!LoadTag(in, m_AccelTag)) {
+			return;
+		}
+
+		uint32_t type = 0;
+		uint64_t hash = 0;
+		LibUtility::Load(in, type);
+		LibUtility::Load(in, hash);
+
+		std::shared_ptr<LibAccel<T, I>> accel;
+		switch (static_cast<typename LibAccel<T, I>::Type>(type)) {
+		case LibAccel<T, I>::Type::BVH:
+			accel = std::make_shared<LibBVH<T, I>>();
+			break;
+		case LibAccel<T, I>::Type::Grid:
+			accel = std::make_shared<LibGrid<T, I>>();
+			break;
+		default:
+			return;
+		}
+
+		accel->Load(in);
+		if (in && hash == GeometryHash()) {
+			m_accel = accel;
+		}
+	}
+
+	// every chunk keeps its own closest hit, the partials are merged with the lower index winning a tie
+	bool IsIntersectionRayParallel(const LibRay<T>& ray, LibPoint<T>& pt, int& srfc, LibThreadPool& tp) const {
+		using Closest = std::pair<T, size_t>;
+		const LibVector<T> dir = ray.Direction().GetNormalize();
+		const std::shared_ptr<const LibTrnglCache<T>> cache = TrnglCache(tp);
+
+		Closest closest = LibParallel::Reduce(tp, 0, TrinaglesNum(), m_ParallelGrain,
+			Closest(std::numeric_limits<T>::max(), 0),
+			[&](size_t first, size_t last) {
+				Closest res(std::numeric_limits<T>::max(), 0);
+				cache->IsIntersectionRange(ray.Origin(), dir, first, last, res.first, res.second);
+				return res;
+			},
+			[](const Closest& a, const Closest& b) { return b.first < a.first ? b : a; });
+
+		if (closest.first == std::numeric_limits<T>::max()) {
+			return false;
+		}
+
+		pt = ray.Origin() + closest.first * dir;
+		srfc = FindSurfForTrngl(closest.second);
+		return true;
+	}
+
+	// barycentrics are recomputed for the one triangle found
+	void FillHit(const LibPoint<T>& org, const LibVector<T>& dir, T dist, size_t ind, LibHit<T>& hit) const {
+		T trnglDist;
+		IsIntersectionTrngl(org, dir, ind, trnglDist, hit.m_u, hit.m_v);
+		hit.m_dist = dist;
+		hit.m_trngl = ind;
+		hit.m_srfc = FindSurfForTrngl(ind);
+		hit.m_pt = org + dist * dir;
+	}
+
+	void IsIntersectionPacket(const LibRayPacket<T>& packet, T* dist, size_t* ind) const {
+		using Pack = typename LibRayPacket<T>::Pack;
+		std::fill(dist, dist + LibRayPacket<T>::Size, std::numeric_limits<T>::max());
+		std::fill(ind, ind + LibRayPacket<T>::Size, 0);
+
+		Pack tMax(std::numeric_limits<T>::max());
+		for (size_t i = 0; i < TrinaglesNum(); i++) {
+			packet.IntersectTrngl(GetPtInTrngl(i, 0), GetPtInTrngl(i, 1), GetPtInTrngl(i, 2), i, tMax, dist, ind);
+		}
+	}
+
 	static void GetCirclePoints(std::vector<LibPoint<T>>& vecPoints, std::vector<LibVector<T>>& vecNormals,
-		std::vector<size_t>& vecTriangles, std::vector<Surface>& vecSurfaces,
+		std::vector<I>& vecTriangles, std::vector<Surface>& vecSurfaces,
 		const LibPoint<T>& pt_Center, const LibVector<T>& vec_Direction,
 		T Radius, T angle, T dirCoef)
 	{
@@ -488,14 +948,14 @@ protected:
 
 		for (size_t i = 1; i <= pntsCountOnCrcl; ++i)
 		{
-			vecTriangles.push_back(pntsCount);
+			vecTriangles.push_back(static_cast<I>(pntsCount));
 			if (dirCoef == -1) {
-				vecTriangles.push_back(pntsCount + 1 + i % (pntsCountOnCrcl));
-				vecTriangles.push_back(pntsCount + i);
+				vecTriangles.push_back(static_cast<I>(pntsCount + 1 + i % (pntsCountOnCrcl)));
+				vecTriangles.push_back(static_cast<I>(pntsCount + i));
 			}
 			else {
-				vecTriangles.push_back(pntsCount + i);
-				vecTriangles.push_back(pntsCount + 1 + i % (pntsCountOnCrcl));
+				vecTriangles.push_back(static_cast<I>(pntsCount + i));
+				vecTriangles.push_back(static_cast<I>(pntsCount + 1 + i % (pntsCountOnCrcl)));
 			}
 			
 		}
@@ -503,48 +963,40 @@ protected:
 	}
 
 private:
-	class IntersectionTask : public Task {
-		const LibModel<T>& model;
-		const LibRay<T>& ray;
-		size_t startIndex;
-		size_t count;
-		T& minDist;
-		size_t& minInd;
-		std::mutex& mtx;
+	void SyncPointsSoA() {
+		if (m_layout == Layout::SoA) {
+			m_soaPoints.Assign(m_vecPoints);
+		}
+		else {
+			m_soaPoints.Clear();
+		}
+	}
 
-	public:
-		IntersectionTask(const LibModel<T>& mdl, const LibRay<T>& r, size_t start, size_t cnt,
-			T& minD, size_t& minI, std::mutex& mutex)
-			: model(mdl), ray(r), startIndex(start), count(cnt),
-			minDist(minD), minInd(minI), mtx(mutex) { }
-
-		void Do() override {
-			for (size_t i = startIndex * 3; i < (startIndex + count) * 3; i += 3) {
-				LibTriangle<T> trngl(model.Points()[model.Triangles()[i]],
-					model.Points()[model.Triangles()[i + 1]],
-					model.Points()[model.Triangles()[i + 2]]);
-
-				LibPoint<T> localIntersPt;
-				if (trngl.IsIntersectionLine(ray, localIntersPt)) {
-					if (!ray.IsPointOnLine(localIntersPt)) {
-						continue;
-					}
-
-					T curDist = localIntersPt.DistanceTo(ray.Origin());
-
-					mtx.lock();
-					if (curDist < minDist) {
-						minDist = curDist;
-						minInd = i / 3;
-					}
-					mtx.unlock();
-				}
-			}
+	void SyncNormalsSoA() {
+		if (m_layout == Layout::SoA) {
+			m_soaNormals.Assign(m_vecNormals);
 		}
-	};
+		else {
+			m_soaNormals.Clear();
+		}
+	}
 
 	std::vector<LibPoint<T>> m_vecPoints;
 	std::vector<LibVector<T>> m_vecNormals;
-	std::vector<size_t> m_vecTriangles;
+	std::vector<I> m_vecTriangles;
 	std::vector<Surface> m_vecSurfaces;
+
+	LibVector<double> m_origin;
+
+	Layout m_layout = Layout::AoS;
+	LibCoordArray<T> m_soaPoints;
+	LibCoordArray<T> m_soaNormals;
+
+	std::shared_ptr<const LibAccel<T, I>> m_accel;
+	mutable LibCacheSlot<LibTrnglCache<T>> m_trnglCache;
+
+	static constexpr uint32_t m_AccelTag = 0x4C434341; // "ACCL"
+	static constexpr uint32_t m_OriginTag = 0x4E47524F; // "ORGN"
+	static constexpr size_t m_ParallelGrain = 1 << 14;
+	static constexpr size_t m_CancelBlock = 1 << 15;
 };
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "LibThreadPool.h"
+
+// loops over [begin, end) cut into chunks of at least grain indices, one pool task per chunk.
+// The caller waits for its own chunks only, a single chunk runs inline without touching the pool.
+// On a placed pool index i of n belongs to worker i * ThreadsNum() / n and a chunk goes to the owner of its
+// first index, so loops over the same range hand every range to the same worker whatever their chunk count:
+// an array filled by one loop is read on the node that wrote it
+class LibParallel {
+public:
+	// func(first, last) for every chunk
+	template<typename Func>
+	static void For(LibThreadPool& tp, size_t begin, size_t end, size_t grain, Func func) {
+		if (begin >= end) {
+			return;
+		}
+
+		const size_t count = end - begin;
+		const size_t chunks = ChunksCount(tp, count, grain);
+		if (chunks == 1) {
+			func(begin, end);
+			return;
+		}
+
+		LibTaskGroup group(tp);
+		for (size_t chunk = 0; chunk < chunks; chunk++) {
+			size_t first = begin + chunk * count / chunks;
+			size_t last = begin + (chunk + 1) * count / chunks;
+			auto job = [&func, first, last]() { func(first, last); };
+			if (tp.IsPlaced()) {
+				group.RunOn(Owner(first - begin, count, tp.ThreadsNum()), job);
+			}
+			else {
+				group.Run(job);
+			}
+		}
+		group.Wait();
+	}
+
+	// func(i) for every index
+	template<typename Func>
+	static void ForEach(LibThreadPool& tp, size_t begin, size_t end, size_t grain, Func func) {
+		For(tp, begin, end, grain, [&func](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				func(i);
+			}
+		});
+	}
+
+	// map(first, last) gives the partial result of a chunk, partials are combined in chunk order
+	// so the result does not depend on which worker ran what
+	template<typename R, typename Map, typename Combine>
+	static R Reduce(LibThreadPool& tp, size_t begin, size_t end, size_t grain, R identity, Map map, Combine combine) {
+		if (begin >= end) {
+			return identity;
+		}
+
+		const size_t count = end - begin;
+		const size_t chunks = ChunksCount(tp, count, grain);
+		std::vector<R> partials(chunks, identity);
+		For(tp, 0, chunks, 1, [&](size_t first, size_t last) {
+			for (size_t chunk = first; chunk < last; chunk++) {
+				partials[chunk] = map(begin + chunk * count / chunks, begin + (chunk + 1) * count / chunks);
+			}
+		});
+
+		R res = identity;
+		for (const R& partial : partials) {
+			res = combine(res, partial);
+		}
+		return res;
+	}
+
+private:
+	// up to four chunks per worker so that stealing can even out chunks of uneven cost. Background
+	// loops are cut into grain sized chunks whatever their length, so an interactive task waits for
+	// one chunk at most and never for the whole loop
+	static size_t ChunksCount(const LibThreadPool& tp, size_t count, size_t grain) {
+		const size_t chunks = std::max<size_t>(count / std::max<size_t>(grain, 1), 1);
+		if (LibThreadPool::CurrentPriority() == LibPriority::Background) {
+			return chunks;
+		}
+		return std::min(chunks, tp.ThreadsNum() * 4);
+	}
+
+	// the worker whose share [w * count / threads, (w + 1) * count / threads) holds index
+	static size_t Owner(size_t index, size_t count, size_t threads) {
+		return ((index + 1) * threads - 1) / count;
+	}
+};
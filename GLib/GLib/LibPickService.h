@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "LibModel.h"
+#include "LibThreadPool.h"
+#include "LibCancelToken.h"
+
+// picks on pool threads, latest wins: a new request cancels the query in flight and results of older
+// requests are dropped. onResult(hit, generation) runs on the pool thread, a caller that hands the
+// result over to another thread checks IsLatest(generation) again once it gets there.
+// Every query holds the model it was requested on, SetModel() swaps the model for later requests
+// without waiting for the query in flight
+template<typename T, typename I = uint32_t>
+class LibPickService {
+public:
+	using Model = std::shared_ptr<const LibModel<T, I>>;
+
+	explicit LibPickService(LibThreadPool& tp) : m_group(tp), m_generation(0) {}
+
+	LibPickService(Model mdl, LibThreadPool& tp) : m_group(tp), m_mdl(std::move(mdl)), m_generation(0) {}
+
+	LibPickService(const LibPickService&) = delete;
+	LibPickService& operator=(const LibPickService&) = delete;
+
+	~LibPickService() {
+		Cancel();
+		Wait();
+	}
+
+	template<typename OnResult>
+	uint64_t Request(const LibRay<T>& ray, T tMin, T tMax, OnResult onResult) {
+		std::shared_ptr<LibCancelToken> token = std::make_shared<LibCancelToken>();
+		Model mdl;
+		uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_token) {
+				m_token->Cancel();
+			}
+			m_token = token;
+			mdl = m_mdl;
+			generation = ++m_generation;
+		}
+		if (!mdl) {
+			return generation;
+		}
+
+		m_group.Run([this, mdl, ray, tMin, tMax, token, generation, onResult]() {
+			LibHit<T> hit;
+			mdl->IsIntersectionRay(ray, tMin, tMax, hit, *token);
+			if (!token->IsCancelled() && IsLatest(generation)) {
+				onResult(hit, generation);
+			}
+		});
+		return generation;
+	}
+
+	inline bool IsLatest(uint64_t generation) const {
+		return generation == m_generation;
+	}
+
+	// cancels the query in flight, the old model lives on until it stops
+	void SetModel(Model mdl) {
+		Cancel();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_mdl = std::move(mdl);
+	}
+
+	// the query in flight stops at its next check and no pending result is delivered
+	void Cancel() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_token) {
+			m_token->Cancel();
+			m_token.reset();
+		}
+		m_generation++;
+	}
+
+	void Wait() {
+		m_group.Wait();
+	}
+
+private:
+	LibTaskGroup m_group;
+
+	std::mutex m_mutex;
+	Model m_mdl;
+	std::shared_ptr<LibCancelToken> m_token;
+	std::atomic<uint64_t> m_generation;
+};
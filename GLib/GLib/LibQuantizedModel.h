@@ -0,0 +1,397 @@
+#pragma once
+
+#include <vector>
+#include <istream>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include "LibModel.h"
+#include "LibTrnglKernel.h"
+#include "LibAABB.h"
+#include "LibHit.h"
+#include "LibSimd.h"
+
+// compressed copy of the positions of a model for assemblies too large for LibPoint<double> vertices. Every
+// surface keeps its own vertices, quantized to Bits per coordinate over the bounding box of the surface:
+// 16 bits are three uint16_t arrays, 21 bits one uint64_t per vertex. Queries skip surfaces by their box and
+// test four triangles at a time: the corners are gathered lane by lane, since triangles index scattered
+// vertices, then scaled to positions and intersected in packs. Decoded positions are off by up to half a
+// step per axis, Pick() refines the triangles near the decoded hit on exact positions supplied by the
+// caller: the points of the model when it is in memory, or LoadPoint() re-reading the few refined vertices
+// from the file Load() built it from, so the exact positions of an assembly never have to be held in RAM
+template<typename T, unsigned Bits = 16, typename I = uint32_t>
+class LibQuantizedModel {
+	static_assert(Bits == 16 || Bits == 21, "positions are quantized to 16 or 21 bits");
+
+public:
+	using Pack = LibPack4<T>;
+	using Kernel = LibTrnglKernel<T>;
+	static constexpr size_t Size = Pack::Size;
+	static constexpr uint32_t m_MaxQuant = (1u << Bits) - 1;
+
+	// triangles [m_firstTrngl, m_lastTrngl) and their vertices [m_firstVtx, m_lastVtx) of one surface of
+	// the model, m_srfc is -1 for triangles of no surface
+	struct Surface {
+		LibAABB<T> m_box;
+		T m_step[3] = {};
+		size_t m_firstTrngl = 0;
+		size_t m_lastTrngl = 0;
+		size_t m_firstVtx = 0;
+		size_t m_lastVtx = 0;
+		int m_srfc = -1;
+	};
+
+	LibQuantizedModel() = default;
+
+	explicit LibQuantizedModel(const LibModel<T, I>& mdl) {
+		Build(mdl);
+	}
+
+	void Build(const LibModel<T, I>& mdl) {
+		Build(mdl.Points(), mdl.Triangles(), mdl.Surfaces());
+	}
+
+	void Build(const std::vector<LibPoint<T>>& points, const std::vector<I>& triangles,
+		const std::vector<typename LibModel<T, I>::Surface>& surfaces) {
+		TIMER_START("build quantized model");
+		Clear();
+		m_vecTriangles.resize(triangles.size());
+
+		std::vector<size_t> stored(points.size(), m_NoVertex);
+		for (const Surface& range : Ranges(surfaces, triangles.size() / 3)) {
+			Surface srfc = range;
+			srfc.m_firstVtx = m_vecGlobal.size();
+			for (size_t i = 3 * srfc.m_firstTrngl; i < 3 * srfc.m_lastTrngl; i++) {
+				size_t vtx = triangles[i];
+				if (stored[vtx] == m_NoVertex || stored[vtx] < srfc.m_firstVtx) {
+					stored[vtx] = m_vecGlobal.size();
+					m_vecGlobal.push_back(static_cast<I>(vtx));
+					srfc.m_box.Extend(points[vtx]);
+				}
+				m_vecTriangles[i] = static_cast<I>(stored[vtx]);
+			}
+			srfc.m_lastVtx = m_vecGlobal.size();
+
+			for (size_t axis = 0; axis < 3; axis++) {
+				T extent = srfc.m_box.IsEmpty() ? 0 : srfc.m_box.Max().At(axis) - srfc.m_box.Min().At(axis);
+				srfc.m_step[axis] = extent / m_MaxQuant;
+			}
+			for (size_t vtx = srfc.m_firstVtx; vtx < srfc.m_lastVtx; vtx++) {
+				Store(srfc, points[m_vecGlobal[vtx]]);
+			}
+			m_vecSurfaces.push_back(srfc);
+		}
+		TIMER_END("build quantized model");
+	}
+
+	// builds from a file written by LibModel::Save without making the model: normals are skipped, points and
+	// indices are dropped once quantized. Returns false if the stream ends early or an index does not fit I
+	bool Load(std::istream& in) {
+		Clear();
+		m_pointsPos = in.tellg();
+		std::vector<LibPoint<T>> points;
+		LibUtility::LoadVec(in, points);
+
+		size_t normals = 0;
+		LibUtility::Load(in, normals);
+		in.seekg(normals * m_PointSize, std::ios::cur);
+
+		std::vector<I> triangles;
+		LibUtility::LoadBufAs<size_t>(in, triangles);
+		std::vector<typename LibModel<T, I>::Surface> surfaces;
+		LibUtility::LoadVec(in, surfaces);
+		if (!in) {
+			return false;
+		}
+
+		Build(points, triangles, surfaces);
+		return true;
+	}
+
+	// exact position of a model vertex read back from the file Load() built from, for Pick()
+	LibPoint<T> LoadPoint(std::istream& in, size_t vtx) const {
+		LibPoint<T> pt;
+		in.seekg(m_pointsPos + static_cast<std::streamoff>(sizeof(size_t) + vtx * m_PointSize));
+		pt.Load(in);
+		return pt;
+	}
+
+	void Clear() {
+		m_vecSurfaces.clear();
+		m_vecTriangles.clear();
+		m_vecGlobal.clear();
+		m_x.clear();
+		m_y.clear();
+		m_z.clear();
+		m_packed.clear();
+		m_pointsPos = 0;
+	}
+
+	inline size_t TrinaglesNum() const {
+		return m_vecTriangles.size() / 3;
+	}
+
+	inline size_t VerticesNum() const {
+		return m_vecGlobal.size();
+	}
+
+	inline const std::vector<Surface>& Surfaces() const {
+		return m_vecSurfaces;
+	}
+
+	// stored vertex of a corner of a model triangle
+	inline size_t GetVertex(size_t idxTriangle, size_t pos) const {
+		return m_vecTriangles[3 * idxTriangle + pos];
+	}
+
+	// model vertex a stored vertex was quantized from
+	inline size_t GlobalVertex(size_t vtx) const {
+		return m_vecGlobal[vtx];
+	}
+
+	LibPoint<T> Decode(const Surface& srfc, size_t vtx) const {
+		uint32_t q[3];
+		Load(vtx, q);
+		return LibPoint<T>(srfc.m_box.Min().X() + q[0] * srfc.m_step[0], srfc.m_box.Min().Y() + q[1] * srfc.m_step[1],
+			srfc.m_box.Min().Z() + q[2] * srfc.m_step[2]);
+	}
+
+	LibPoint<T> DecodeInTrngl(size_t idxTriangle, size_t pos) const {
+		return Decode(SurfaceOf(idxTriangle), GetVertex(idxTriangle, pos));
+	}
+
+	// bytes held by positions, indices and surfaces
+	size_t MemorySize() const {
+		return m_vecSurfaces.size() * sizeof(Surface) + (m_vecTriangles.size() + m_vecGlobal.size()) * sizeof(I) +
+			(m_x.size() + m_y.size() + m_z.size()) * sizeof(uint16_t) + m_packed.size() * sizeof(uint64_t);
+	}
+
+	// closest hit in [tMin, tMax) on the decoded triangles
+	bool IsIntersectionRay(const LibRay<T>& ray, T tMin, T tMax, LibHit<T>& hit) const {
+		hit.m_isHit = false;
+		const LibVector<T> dir = ray.Direction().GetNormalize();
+		T dist = tMax;
+		size_t ind = 0;
+		bool isFound = false;
+		Trace(ray.Origin(), dir, tMin, [&](int bits, const Pack& t, size_t first) {
+			isFound = Kernel::UpdateClosest(bits, t, first, dist, ind) || isFound;
+			return dist;
+		}, dist);
+		if (!isFound) {
+			return false;
+		}
+
+		T trnglDist;
+		hit.m_isHit = true;
+		hit.m_dist = dist;
+		hit.m_trngl = ind;
+		hit.m_srfc = SurfaceOf(ind).m_srfc;
+		Kernel::IsIntersection(ray.Origin(), dir, DecodeInTrngl(ind, 0), DecodeInTrngl(ind, 1), DecodeInTrngl(ind, 2),
+			trnglDist, hit.m_u, hit.m_v);
+		hit.m_pt = ray.Origin() + dist * dir;
+		return true;
+	}
+
+	// closest hit with full precision: the decoded query gives the closest distance, every triangle hit
+	// within two quantization steps of it, the largest step of the surfaces the ray crosses, is intersected
+	// again on exact(modelVertex) positions. A ray that grazes an edge may miss a decoded triangle it hits
+	// exactly. If no candidate hits exactly the decoded hit is returned
+	template<typename Exact>
+	bool Pick(const LibRay<T>& ray, T tMin, T tMax, LibHit<T>& hit, Exact exact) const {
+		if (!IsIntersectionRay(ray, tMin, tMax, hit)) {
+			return false;
+		}
+
+		const LibVector<T> dir = ray.Direction().GetNormalize();
+		const T window = std::min(tMax, hit.m_dist + 2 * MaxStepLength(ray.Origin(), dir, tMin, tMax));
+		T best = tMax;
+		LibHit<T> res;
+		Trace(ray.Origin(), dir, tMin, [&](int bits, const Pack&, size_t first) {
+			for (size_t lane = 0; lane < Size; lane++) {
+				if (!((bits >> lane) & 1)) {
+					continue;
+				}
+				size_t trngl = first + lane;
+				T dist, u, v;
+				if (Kernel::IsIntersection(ray.Origin(), dir, exact(GlobalVertex(GetVertex(trngl, 0))),
+					exact(GlobalVertex(GetVertex(trngl, 1))), exact(GlobalVertex(GetVertex(trngl, 2))), dist, u, v) &&
+					dist >= tMin && dist < best) {
+					best = dist;
+					res.m_isHit = true;
+					res.m_dist = dist;
+					res.m_trngl = trngl;
+					res.m_u = u;
+					res.m_v = v;
+				}
+			}
+			return window;
+		}, window);
+
+		if (res.m_isHit) {
+			res.m_srfc = SurfaceOf(res.m_trngl).m_srfc;
+			res.m_pt = ray.Origin() + res.m_dist * dir;
+			hit = res;
+		}
+		return true;
+	}
+
+private:
+	// surfaces of the model sorted by their first triangle, gaps between them become ranges of their own
+	static std::vector<Surface> Ranges(const std::vector<typename LibModel<T, I>::Surface>& surfaces, size_t trnglsNum) {
+		std::vector<Surface> ranges;
+		for (size_t i = 0; i < surfaces.size(); i++) {
+			Surface srfc;
+			srfc.m_firstTrngl = surfaces[i].Begin();
+			srfc.m_lastTrngl = std::min(surfaces[i].End(), trnglsNum);
+			srfc.m_srfc = static_cast<int>(i);
+			if (srfc.m_firstTrngl < srfc.m_lastTrngl) {
+				ranges.push_back(srfc);
+			}
+		}
+		std::sort(ranges.begin(), ranges.end(),
+			[](const Surface& a, const Surface& b) { return a.m_firstTrngl < b.m_firstTrngl; });
+
+		std::vector<Surface> res;
+		size_t next = 0;
+		for (const Surface& srfc : ranges) {
+			if (srfc.m_firstTrngl < next) {
+				continue;
+			}
+			if (srfc.m_firstTrngl > next) {
+				Surface gap;
+				gap.m_firstTrngl = next;
+				gap.m_lastTrngl = srfc.m_firstTrngl;
+				res.push_back(gap);
+			}
+			res.push_back(srfc);
+			next = srfc.m_lastTrngl;
+		}
+		if (next < trnglsNum) {
+			Surface gap;
+			gap.m_firstTrngl = next;
+			gap.m_lastTrngl = trnglsNum;
+			res.push_back(gap);
+		}
+		return res;
+	}
+
+	const Surface& SurfaceOf(size_t idxTriangle) const {
+		auto it = std::upper_bound(m_vecSurfaces.begin(), m_vecSurfaces.end(), idxTriangle,
+			[](size_t trngl, const Surface& srfc) { return trngl < srfc.m_lastTrngl; });
+		return *it;
+	}
+
+	static T StepLength(const Surface& srfc) {
+		return std::sqrt(srfc.m_step[0] * srfc.m_step[0] + srfc.m_step[1] * srfc.m_step[1] +
+			srfc.m_step[2] * srfc.m_step[2]);
+	}
+
+	// a closer exact hit may lie on any surface the ray crosses, each decoded with its own step
+	T MaxStepLength(const LibPoint<T>& org, const LibVector<T>& dir, T tMin, T tMax) const {
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+		T res = 0;
+		for (const Surface& srfc : m_vecSurfaces) {
+			T tNear, tFar;
+			if (srfc.m_box.IsIntersectionRay(org, dirInv, tMin, tMax, tNear, tFar)) {
+				res = std::max(res, StepLength(srfc));
+			}
+		}
+		return res;
+	}
+
+	void Store(const Surface& srfc, const LibPoint<T>& pt) {
+		uint32_t q[3];
+		for (size_t axis = 0; axis < 3; axis++) {
+			T val = srfc.m_step[axis] > 0 ? (pt.At(axis) - srfc.m_box.Min().At(axis)) / srfc.m_step[axis] : 0;
+			q[axis] = static_cast<uint32_t>(std::min<T>(std::round(val), m_MaxQuant));
+		}
+		if constexpr (Bits == 16) {
+			m_x.push_back(static_cast<uint16_t>(q[0]));
+			m_y.push_back(static_cast<uint16_t>(q[1]));
+			m_z.push_back(static_cast<uint16_t>(q[2]));
+		}
+		else {
+			m_packed.push_back(uint64_t(q[0]) | (uint64_t(q[1]) << Bits) | (uint64_t(q[2]) << (2 * Bits)));
+		}
+	}
+
+	inline void Load(size_t vtx, uint32_t (&q)[3]) const {
+		if constexpr (Bits == 16) {
+			q[0] = m_x[vtx];
+			q[1] = m_y[vtx];
+			q[2] = m_z[vtx];
+		}
+		else {
+			uint64_t word = m_packed[vtx];
+			q[0] = static_cast<uint32_t>(word & m_MaxQuant);
+			q[1] = static_cast<uint32_t>((word >> Bits) & m_MaxQuant);
+			q[2] = static_cast<uint32_t>(word >> (2 * Bits));
+		}
+	}
+
+	// onBlock(bits, t, firstTrngl) gets the lanes of every block of four decoded triangles hitting in
+	// [tMin, bound) and returns the new bound. Lanes past the end of a surface are degenerate and never hit
+	template<typename OnBlock>
+	void Trace(const LibPoint<T>& org, const LibVector<T>& dir, T tMin, OnBlock onBlock, T bound) const {
+		T dirInv[3];
+		LibAABB<T>::GetDirInv(dir, dirInv);
+		for (const Surface& srfc : m_vecSurfaces) {
+			T tNear, tFar;
+			if (!srfc.m_box.IsIntersectionRay(org, dirInv, tMin, bound, tNear, tFar)) {
+				continue;
+			}
+
+			const Pack min[3] = { Pack(srfc.m_box.Min().X()), Pack(srfc.m_box.Min().Y()), Pack(srfc.m_box.Min().Z()) };
+			const Pack step[3] = { Pack(srfc.m_step[0]), Pack(srfc.m_step[1]), Pack(srfc.m_step[2]) };
+			for (size_t first = srfc.m_firstTrngl; first < srfc.m_lastTrngl; first += Size) {
+				// scalar gather, the lanes are scattered vertices
+				T q[3][3][Size] = {};
+				for (size_t lane = 0; lane < Size && first + lane < srfc.m_lastTrngl; lane++) {
+					for (size_t k = 0; k < 3; k++) {
+						uint32_t vtx[3];
+						Load(GetVertex(first + lane, k), vtx);
+						q[k][0][lane] = static_cast<T>(vtx[0]);
+						q[k][1][lane] = static_cast<T>(vtx[1]);
+						q[k][2][lane] = static_cast<T>(vtx[2]);
+					}
+				}
+
+				// edges are differences of integers, exact before the scale
+				Pack a[3], e1[3], e2[3];
+				for (size_t axis = 0; axis < 3; axis++) {
+					Pack q0 = Pack::Load(q[0][axis]);
+					a[axis] = min[axis] + q0 * step[axis];
+					e1[axis] = (Pack::Load(q[1][axis]) - q0) * step[axis];
+					e2[axis] = (Pack::Load(q[2][axis]) - q0) * step[axis];
+				}
+
+				Pack t;
+				int bits = Kernel::IsIntersection4(org, dir, a, e1, e2, Pack(tMin), Pack(bound), t);
+				if (bits != 0) {
+					bound = onBlock(bits, t, first);
+				}
+			}
+		}
+	}
+
+	static constexpr size_t m_NoVertex = std::numeric_limits<size_t>::max();
+	// bytes of a point or a normal in a model file
+	static constexpr size_t m_PointSize = 3 * sizeof(T);
+
+	std::vector<Surface> m_vecSurfaces;
+	std::vector<I> m_vecTriangles;
+	std::vector<I> m_vecGlobal;
+
+	// 16 bits
+	std::vector<uint16_t> m_x;
+	std::vector<uint16_t> m_y;
+	std::vector<uint16_t> m_z;
+	// 21 bits
+	std::vector<uint64_t> m_packed;
+
+	// start of the points in the stream given to Load()
+	std::istream::pos_type m_pointsPos = 0;
+};
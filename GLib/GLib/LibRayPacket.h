@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <span>
+#include <vector>
+#include "LibPoint.h"
+#include "LibVector.h"
+#include "LibRay.h"
+#include "LibAABB.h"
+#include "LibEps.h"
+#include "LibSimd.h"
+#include "LibTrnglKernel.h"
+
+// up to four rays tested together, one ray per SIMD lane with normalized directions
+template<typename T>
+class LibRayPacket {
+public:
+	using Pack = LibPack4<T>;
+	using Mask = typename Pack::Mask;
+	static constexpr size_t Size = Pack::Size;
+
+	// unused lanes repeat the last ray and stay inactive
+	LibRayPacket(const LibRay<T>* const* rays, size_t count) : m_count(count), m_active(static_cast<int>((1u << count) - 1)) {
+		T org[3][Size], dir[3][Size], dirInv[3][Size];
+		for (size_t lane = 0; lane < Size; lane++) {
+			m_rays[lane] = rays[std::min(lane, count - 1)];
+			LibVector<T> vecDir = m_rays[lane]->Direction().GetNormalize();
+			T inv[3];
+			LibAABB<T>::GetDirInv(vecDir, inv);
+			for (size_t axis = 0; axis < 3; axis++) {
+				org[axis][lane] = m_rays[lane]->Origin().At(axis);
+				dir[axis][lane] = vecDir.At(axis);
+				dirInv[axis][lane] = inv[axis];
+			}
+		}
+
+		for (size_t axis = 0; axis < 3; axis++) {
+			m_org[axis] = Pack::Load(org[axis]);
+			m_dir[axis] = Pack::Load(dir[axis]);
+			m_dirInv[axis] = Pack::Load(dirInv[axis]);
+		}
+	}
+
+	inline size_t Count() const {
+		return m_count;
+	}
+
+	inline const LibRay<T>& Ray(size_t lane) const {
+		return *m_rays[lane];
+	}
+
+	// sign pattern of the direction, rays of one octant traverse nodes in the same order
+	static int Octant(const LibRay<T>& ray) {
+		const LibVector<T>& dir = ray.Direction();
+		return (dir.X() < 0 ? 1 : 0) | (dir.Y() < 0 ? 2 : 0) | (dir.Z() < 0 ? 4 : 0);
+	}
+
+	// permutation of the first count rays that groups them by octant, stable within an octant
+	static void OrderByOctant(std::span<const LibRay<T>> rays, size_t count, std::vector<size_t>& order) {
+		size_t octantStart[9] = {};
+		for (size_t i = 0; i < count; i++) {
+			octantStart[Octant(rays[i]) + 1]++;
+		}
+		for (size_t i = 1; i < 9; i++) {
+			octantStart[i] += octantStart[i - 1];
+		}
+
+		order.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			order[octantStart[Octant(rays[i])]++] = i;
+		}
+	}
+
+	// slab test per lane, lanes whose entry is beyond tMax are culled
+	Mask IsIntersectionBox(const LibAABB<T>& box, const Pack& tMax) const {
+		Pack tNear(0);
+		Pack tFar = tMax;
+		for (size_t axis = 0; axis < 3; axis++) {
+			Pack t1 = (Pack(box.Min().At(axis)) - m_org[axis]) * m_dirInv[axis];
+			Pack t2 = (Pack(box.Max().At(axis)) - m_org[axis]) * m_dirInv[axis];
+			tNear = Pack::Max(tNear, Pack::Min(t1, t2));
+			tFar = Pack::Min(tFar, Pack::Max(t1, t2));
+		}
+		return (tNear <= tFar) & m_active;
+	}
+
+	// LibTrnglKernel's test for all lanes against one triangle, reports lanes hitting at dist <= tMax
+	Mask IsIntersectionTrngl(const LibPoint<T>& A, const LibPoint<T>& B, const LibPoint<T>& C,
+		const Pack& tMax, Pack& dist) const {
+		LibVector<T> AB = B - A;
+		LibVector<T> AC = C - A;
+		const Pack a[3] = { Pack(A.X()), Pack(A.Y()), Pack(A.Z()) };
+		const Pack e1[3] = { Pack(AB.X()), Pack(AB.Y()), Pack(AB.Z()) };
+		const Pack e2[3] = { Pack(AC.X()), Pack(AC.Y()), Pack(AC.Z()) };
+
+		Mask isHit = LibTrnglKernel<T>::Crossing4(m_org, m_dir, a, e1, e2, dist);
+		return isHit & m_active & (dist >= Pack(0)) & (dist <= tMax);
+	}
+
+	// tests one triangle and keeps the closest hit per lane, ties go to the lower triangle index
+	bool IntersectTrngl(const LibPoint<T>& A, const LibPoint<T>& B, const LibPoint<T>& C, size_t trngl,
+		Pack& tMax, T* dist, size_t* ind) const {
+		Pack curDist;
+		int bits = IsIntersectionTrngl(A, B, C, tMax, curDist).Bits();
+		if (bits == 0) {
+			return false;
+		}
+
+		T lanes[Size];
+		curDist.Store(lanes);
+		bool isUpdated = false;
+		for (size_t lane = 0; lane < Size; lane++) {
+			if (((bits >> lane) & 1) && (lanes[lane] < dist[lane] || (lanes[lane] == dist[lane] && trngl < ind[lane]))) {
+				dist[lane] = lanes[lane];
+				ind[lane] = trngl;
+				isUpdated = true;
+			}
+		}
+		tMax = Pack::Load(dist);
+		return isUpdated;
+	}
+
+private:
+	Pack m_org[3];
+	Pack m_dir[3];
+	Pack m_dirInv[3];
+	const LibRay<T>* m_rays[Size];
+	size_t m_count;
+	Mask m_active;
+};
@@ -7,6 +7,15 @@ template<typename T>
 class LibSegment : public LibLine<T>
 {
 public:
+	LibSegment() = default;
+	LibSegment(const LibPoint<T>& ptBegin, const LibPoint<T>& ptEnd)
+		: LibLine<T>(ptBegin, ptEnd - ptBegin) {}
+
+	inline T Length() const
+	{
+		return this->Direction().LengthVector();
+	}
+
 	inline const LibPoint<T> EndPoint() const
 	{
 		return this->Origin() + this->Direction();
@@ -15,28 +24,27 @@ public:
 	bool IsIntersectionLine(const LibLine<T>& lnOther, LibPoint<T>& intersPoint) const override
 	{
 		T coefL, coefS;
-		if (GetIntersParam(lnOther, coefL, coefS))
+		if (this->GetIntersParam(lnOther, coefL, coefS))
 		{
 			if (coefS < 0 || coefS > 1)
 			{
 				return false;
 			}
-			return GetIntersection(coefS);
+			return this->GetIntersection(coefS, intersPoint);
 		}
-		return false
-
+		return false;
 	}
 
 	bool IsIntersectionRay(const LibRay<T>& rayOther, LibPoint<T>& intersPoint) const
 	{
 		T coefR, coefS;
-		if (GetIntersParam(rayOther, coefR, coefS))
+		if (this->GetIntersParam(rayOther, coefR, coefS))
 		{
-			if ((coefS < 0 || coefS > 1) && coefR < 0)
+			if (coefS < 0 || coefS > 1 || coefR < 0)
 			{
 				return false;
 			}
-			return GetIntersection(coefS);
+			return this->GetIntersection(coefS, intersPoint);
 		}
 		return false;
 	}
@@ -44,13 +52,13 @@ public:
 	bool IsIntersectionSegment(const LibSegment<T>& sgmntOther, LibPoint<T>& intersPoint) const
 	{
 		T coef1, coef2;
-		if (GetIntersParam(sgmntOther, coef1, coef2))
+		if (this->GetIntersParam(sgmntOther, coef1, coef2))
 		{
 			if (coef2 < 0 || coef2 > 1 || coef1 < 0 || coef1 > 1)
 			{
 				return false;
 			}
-			return GetIntersection(coef2);
+			return this->GetIntersection(coef2, intersPoint);
 		}
 		return false;
 	}
@@ -62,7 +70,7 @@ public:
 		LibVector<T> BegPoint = point - this->Origin();
 		LibVector<T> BegEnd = this->Direction();
 
-		LibVector<T> projection = BegPoint.DotProduct(BegEnd) / BegEnd.LengthVector();
+		T projection = BegPoint.DotProduct(BegEnd) / BegEnd.LengthVectorPow2();
 		if (projection < 0)
 		{
 			return this->Origin();
@@ -76,14 +84,14 @@ public:
 		}
 	}
 
-	bool IsPointOnLine(const LibPoint<T>& point) const override
+	bool IsPointOnLine(const LibPoint<T>& point, double eps = LibEps::eps) const override
 	{
 		LibPoint<T> end = EndPoint();
 
 		LibVector<T> BegPoint = point - this->Origin();
 		LibVector<T> BegEnd = this->Direction();
 
-		if (BegPoint.IsParallel(BegEnd))
+		if (BegPoint.IsParallel(BegEnd, eps))
 		{
 			if (std::min(this->Origin().X(), end.X()) <= point.X() &&
 				std::max(this->Origin().X(), end.X()) >= point.X() &&
@@ -97,4 +105,4 @@ public:
 		}
 		return false;
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__AVX__) || defined(__AVX2__)
+#include <immintrin.h>
+#define LIB_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIB_SIMD_SSE2
+#endif
+
+// four lanes of T, the generic version is plain loops; double maps to AVX or SSE2 when available.
+// The Release configurations build with /arch:AVX2, Debug keeps the SSE2 baseline
+template<typename T>
+class LibPack4 {
+public:
+	static constexpr size_t Size = 4;
+
+	class Mask {
+	public:
+		Mask() = default;
+		explicit Mask(int bits) {
+			for (size_t i = 0; i < Size; i++) {
+				m_lane[i] = (bits >> i) & 1;
+			}
+		}
+
+		int Bits() const {
+			int bits = 0;
+			for (size_t i = 0; i < Size; i++) {
+				bits |= m_lane[i] << i;
+			}
+			return bits;
+		}
+
+		bool Any() const {
+			return Bits() != 0;
+		}
+
+		Mask operator&(const Mask& other) const {
+			Mask res;
+			for (size_t i = 0; i < Size; i++) {
+				res.m_lane[i] = m_lane[i] && other.m_lane[i];
+			}
+			return res;
+		}
+
+		Mask operator|(const Mask& other) const {
+			Mask res;
+			for (size_t i = 0; i < Size; i++) {
+				res.m_lane[i] = m_lane[i] || other.m_lane[i];
+			}
+			return res;
+		}
+
+		bool m_lane[Size] = {};
+	};
+
+	LibPack4() = default;
+	explicit LibPack4(T val) {
+		for (size_t i = 0; i < Size; i++) {
+			m_data[i] = val;
+		}
+	}
+
+	static LibPack4 Load(const T* ptr) {
+		LibPack4 res;
+		for (size_t i = 0; i < Size; i++) {
+			res.m_data[i] = ptr[i];
+		}
+		return res;
+	}
+
+	void Store(T* ptr) const {
+		for (size_t i = 0; i < Size; i++) {
+			ptr[i] = m_data[i];
+		}
+	}
+
+#define LIB_PACK4_OP(op) \
+	LibPack4 operator op(const LibPack4& other) const { \
+		LibPack4 res; \
+		for (size_t i = 0; i < Size; i++) { \
+			res.m_data[i] = m_data[i] op other.m_data[i]; \
+		} \
+		return res; \
+	}
+
+#define LIB_PACK4_CMP(op) \
+	Mask operator op(const LibPack4& other) const { \
+		Mask res; \
+		for (size_t i = 0; i < Size; i++) { \
+			res.m_lane[i] = m_data[i] op other.m_data[i]; \
+		} \
+		return res; \
+	}
+
+	LIB_PACK4_OP(+)
+	LIB_PACK4_OP(-)
+	LIB_PACK4_OP(*)
+	LIB_PACK4_OP(/)
+	LIB_PACK4_CMP(<)
+	LIB_PACK4_CMP(<=)
+	LIB_PACK4_CMP(>)
+	LIB_PACK4_CMP(>=)
+	LIB_PACK4_CMP(==)
+
+#undef LIB_PACK4_OP
+#undef LIB_PACK4_CMP
+
+	static LibPack4 Min(const LibPack4& a, const LibPack4& b) {
+		LibPack4 res;
+		for (size_t i = 0; i < Size; i++) {
+			res.m_data[i] = std::min(a.m_data[i], b.m_data[i]);
+		}
+		return res;
+	}
+
+	static LibPack4 Max(const LibPack4& a, const LibPack4& b) {
+		LibPack4 res;
+		for (size_t i = 0; i < Size; i++) {
+			res.m_data[i] = std::max(a.m_data[i], b.m_data[i]);
+		}
+		return res;
+	}
+
+	static LibPack4 Abs(const LibPack4& a) {
+		LibPack4 res;
+		for (size_t i = 0; i < Size; i++) {
+			res.m_data[i] = std::fabs(a.m_data[i]);
+		}
+		return res;
+	}
+
+	static LibPack4 Select(const Mask& mask, const LibPack4& a, const LibPack4& b) {
+		LibPack4 res;
+		for (size_t i = 0; i < Size; i++) {
+			res.m_data[i] = mask.m_lane[i] ? a.m_data[i] : b.m_data[i];
+		}
+		return res;
+	}
+
+private:
+	T m_data[Size] = {};
+};
+
+#if defined(LIB_SIMD_AVX)
+
+template<>
+class LibPack4<double> {
+public:
+	static constexpr size_t Size = 4;
+
+	class Mask {
+	public:
+		Mask() : m_val(_mm256_setzero_pd()) {}
+		explicit Mask(__m256d val) : m_val(val) {}
+		explicit Mask(int bits) : m_val(_mm256_castsi256_pd(_mm256_set_epi64x(
+			(bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0, (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0))) {}
+
+		int Bits() const {
+			return _mm256_movemask_pd(m_val);
+		}
+
+		bool Any() const {
+			return Bits() != 0;
+		}
+
+		Mask operator&(const Mask& other) const {
+			return Mask(_mm256_and_pd(m_val, other.m_val));
+		}
+
+		Mask operator|(const Mask& other) const {
+			return Mask(_mm256_or_pd(m_val, other.m_val));
+		}
+
+		__m256d m_val;
+	};
+
+	LibPack4() : m_val(_mm256_setzero_pd()) {}
+	explicit LibPack4(double val) : m_val(_mm256_set1_pd(val)) {}
+	explicit LibPack4(__m256d val) : m_val(val) {}
+
+	static LibPack4 Load(const double* ptr) {
+		return LibPack4(_mm256_loadu_pd(ptr));
+	}
+
+	void Store(double* ptr) const {
+		_mm256_storeu_pd(ptr, m_val);
+	}
+
+	LibPack4 operator+(const LibPack4& other) const { return LibPack4(_mm256_add_pd(m_val, other.m_val)); }
+	LibPack4 operator-(const LibPack4& other) const { return LibPack4(_mm256_sub_pd(m_val, other.m_val)); }
+	LibPack4 operator*(const LibPack4& other) const { return LibPack4(_mm256_mul_pd(m_val, other.m_val)); }
+	LibPack4 operator/(const LibPack4& other) const { return LibPack4(_mm256_div_pd(m_val, other.m_val)); }
+
+	Mask operator<(const LibPack4& other) const { return Mask(_mm256_cmp_pd(m_val, other.m_val, _CMP_LT_OQ)); }
+	Mask operator<=(const LibPack4& other) const { return Mask(_mm256_cmp_pd(m_val, other.m_val, _CMP_LE_OQ)); }
+	Mask operator>(const LibPack4& other) const { return Mask(_mm256_cmp_pd(m_val, other.m_val, _CMP_GT_OQ)); }
+	Mask operator>=(const LibPack4& other) const { return Mask(_mm256_cmp_pd(m_val, other.m_val, _CMP_GE_OQ)); }
+	Mask operator==(const LibPack4& other) const { return Mask(_mm256_cmp_pd(m_val, other.m_val, _CMP_EQ_OQ)); }
+
+	static LibPack4 Min(const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm256_min_pd(a.m_val, b.m_val));
+	}
+
+	static LibPack4 Max(const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm256_max_pd(a.m_val, b.m_val));
+	}
+
+	static LibPack4 Abs(const LibPack4& a) {
+		return LibPack4(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.m_val));
+	}
+
+	static LibPack4 Select(const Mask& mask, const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm256_blendv_pd(b.m_val, a.m_val, mask.m_val));
+	}
+
+private:
+	__m256d m_val;
+};
+
+#elif defined(LIB_SIMD_SSE2)
+
+template<>
+class LibPack4<double> {
+public:
+	static constexpr size_t Size = 4;
+
+	class Mask {
+	public:
+		Mask() : m_lo(_mm_setzero_pd()), m_hi(_mm_setzero_pd()) {}
+		Mask(__m128d lo, __m128d hi) : m_lo(lo), m_hi(hi) {}
+		explicit Mask(int bits) :
+			m_lo(_mm_castsi128_pd(_mm_set_epi32((bits & 2) ? -1 : 0, (bits & 2) ? -1 : 0, (bits & 1) ? -1 : 0, (bits & 1) ? -1 : 0))),
+			m_hi(_mm_castsi128_pd(_mm_set_epi32((bits & 8) ? -1 : 0, (bits & 8) ? -1 : 0, (bits & 4) ? -1 : 0, (bits & 4) ? -1 : 0))) {}
+
+		int Bits() const {
+			return _mm_movemask_pd(m_lo) | (_mm_movemask_pd(m_hi) << 2);
+		}
+
+		bool Any() const {
+			return Bits() != 0;
+		}
+
+		Mask operator&(const Mask& other) const {
+			return Mask(_mm_and_pd(m_lo, other.m_lo), _mm_and_pd(m_hi, other.m_hi));
+		}
+
+		Mask operator|(const Mask& other) const {
+			return Mask(_mm_or_pd(m_lo, other.m_lo), _mm_or_pd(m_hi, other.m_hi));
+		}
+
+		__m128d m_lo;
+		__m128d m_hi;
+	};
+
+	LibPack4() : m_lo(_mm_setzero_pd()), m_hi(_mm_setzero_pd()) {}
+	explicit LibPack4(double val) : m_lo(_mm_set1_pd(val)), m_hi(_mm_set1_pd(val)) {}
+	LibPack4(__m128d lo, __m128d hi) : m_lo(lo), m_hi(hi) {}
+
+	static LibPack4 Load(const double* ptr) {
+		return LibPack4(_mm_loadu_pd(ptr), _mm_loadu_pd(ptr + 2));
+	}
+
+	void Store(double* ptr) const {
+		_mm_storeu_pd(ptr, m_lo);
+		_mm_storeu_pd(ptr + 2, m_hi);
+	}
+
+	LibPack4 operator+(const LibPack4& other) const { return LibPack4(_mm_add_pd(m_lo, other.m_lo), _mm_add_pd(m_hi, other.m_hi)); }
+	LibPack4 operator-(const LibPack4& other) const { return LibPack4(_mm_sub_pd(m_lo, other.m_lo), _mm_sub_pd(m_hi, other.m_hi)); }
+	LibPack4 operator*(const LibPack4& other) const { return LibPack4(_mm_mul_pd(m_lo, other.m_lo), _mm_mul_pd(m_hi, other.m_hi)); }
+	LibPack4 operator/(const LibPack4& other) const { return LibPack4(_mm_div_pd(m_lo, other.m_lo), _mm_div_pd(m_hi, other.m_hi)); }
+
+	Mask operator<(const LibPack4& other) const { return Mask(_mm_cmplt_pd(m_lo, other.m_lo), _mm_cmplt_pd(m_hi, other.m_hi)); }
+	Mask operator<=(const LibPack4& other) const { return Mask(_mm_cmple_pd(m_lo, other.m_lo), _mm_cmple_pd(m_hi, other.m_hi)); }
+	Mask operator>(const LibPack4& other) const { return Mask(_mm_cmpgt_pd(m_lo, other.m_lo), _mm_cmpgt_pd(m_hi, other.m_hi)); }
+	Mask operator>=(const LibPack4& other) const { return Mask(_mm_cmpge_pd(m_lo, other.m_lo), _mm_cmpge_pd(m_hi, other.m_hi)); }
+	Mask operator==(const LibPack4& other) const { return Mask(_mm_cmpeq_pd(m_lo, other.m_lo), _mm_cmpeq_pd(m_hi, other.m_hi)); }
+
+	static LibPack4 Min(const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm_min_pd(a.m_lo, b.m_lo), _mm_min_pd(a.m_hi, b.m_hi));
+	}
+
+	static LibPack4 Max(const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm_max_pd(a.m_lo, b.m_lo), _mm_max_pd(a.m_hi, b.m_hi));
+	}
+
+	static LibPack4 Abs(const LibPack4& a) {
+		__m128d sign = _mm_set1_pd(-0.0);
+		return LibPack4(_mm_andnot_pd(sign, a.m_lo), _mm_andnot_pd(sign, a.m_hi));
+	}
+
+	static LibPack4 Select(const Mask& mask, const LibPack4& a, const LibPack4& b) {
+		return LibPack4(_mm_or_pd(_mm_and_pd(mask.m_lo, a.m_lo), _mm_andnot_pd(mask.m_lo, b.m_lo)),
+			_mm_or_pd(_mm_and_pd(mask.m_hi, a.m_hi), _mm_andnot_pd(mask.m_hi, b.m_hi)));
+	}
+
+private:
+	__m128d m_lo;
+	__m128d m_hi;
+};
+
+#endif
@@ -1,8 +1,22 @@
 #pragma once
 #include <vector>
+#include <deque>
+#include <algorithm>
 #include <thread>
-#include <queue>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <exception>
+#include <utility>
+#include <chrono>
+#include "LibMPMCQueue.h"
+#include "LibAffinity.h"
 
 class Task {
 public:
@@ -14,76 +28,603 @@ protected:
 	int id;
 };
 
-class LibThreadPool {
+// task running any callable, used by Submit and LibTaskGroup::Run
+template<typename Func>
+class LibFuncTask : public Task {
 public:
-	LibThreadPool(size_t numThreads = std::thread::hardware_concurrency()) : 
-		stop(false), LastId(0), complete(0) {
-		for (size_t i = 0; i < numThreads; i++)
-		{
-			threads.emplace_back([this] {
-				while (!stop) {
-					std::unique_ptr<Task> task;
-					
-					std::unique_lock<std::mutex> lock(queueMutex);
-					cv_add.wait(lock, [this] { return stop || !tasks.empty(); });
-
-					if (stop) {
-						return;
-					}
+	explicit LibFuncTask(Func&& fn) : func(std::move(fn)) {}
+
+	void Do() override {
+		func();
+	}
+
+private:
+	Func func;
+};
+
+// callable stored in a fixed buffer inside the task, so the task itself is the only storage it needs.
+// Slots are default-constructed empty and reused: Set() a callable, Do() it, Reset() it
+class LibInlineTask : public Task {
+public:
+	static constexpr size_t m_Capacity = 96;
+
+	template<typename Func>
+	static constexpr bool Fits = sizeof(Func) <= m_Capacity && alignof(Func) <= alignof(std::max_align_t) &&
+		std::is_nothrow_move_constructible_v<Func>;
+
+	LibInlineTask() : invoke(nullptr), destroy(nullptr) {}
+
+	LibInlineTask(const LibInlineTask&) = delete;
+	LibInlineTask& operator=(const LibInlineTask&) = delete;
+
+	~LibInlineTask() override {
+		Reset();
+	}
+
+	template<typename Func>
+	void Set(Func&& fn) {
+		static_assert(Fits<Func>, "callable does not fit the inline buffer");
+		new (buffer) Func(std::move(fn));
+		invoke = [](void* ptr) { (*static_cast<Func*>(ptr))(); };
+		destroy = [](void* ptr) { static_cast<Func*>(ptr)->~Func(); };
+	}
+
+	void Do() override {
+		invoke(buffer);
+	}
+
+	void Reset() {
+		if (destroy) {
+			destroy(buffer);
+			invoke = nullptr;
+			destroy = nullptr;
+		}
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char buffer[m_Capacity];
+	void (*invoke)(void*);
+	void (*destroy)(void*);
+};
 
-					task = std::move(tasks.front());
-					tasks.pop();
+// fixed set of inline task slots allocated once and recycled through a lock-free free list
+class LibTaskArena {
+public:
+	explicit LibTaskArena(size_t count) : slots(count), freeSlots(count) {
+		for (LibInlineTask& slot : slots) {
+			freeSlots.TryPush(&slot);
+		}
+	}
+
+	// nullptr when every slot is in use
+	LibInlineTask* Acquire() {
+		LibInlineTask* slot;
+		return freeSlots.TryPop(slot) ? slot : nullptr;
+	}
+
+	void Release(LibInlineTask* slot) {
+		slot->Reset();
+		freeSlots.TryPush(slot);
+	}
 
-					lock.unlock();
+	bool Owns(const Task* task) const {
+		uintptr_t addr = reinterpret_cast<uintptr_t>(task);
+		return addr >= reinterpret_cast<uintptr_t>(slots.data()) &&
+			addr < reinterpret_cast<uintptr_t>(slots.data() + slots.size());
+	}
+
+private:
+	std::vector<LibInlineTask> slots;
+	LibMPMCQueue<LibInlineTask*> freeSlots;
+};
+
+// interactive tasks are always taken before background ones, a running task is never interrupted
+enum class LibPriority {
+	Interactive = 0,
+	Background = 1
+};
+
+struct LibPoolOptions {
+	size_t threadsNum = std::thread::hardware_concurrency();
+	// every worker bound to one core
+	bool pinThreads = false;
+	// workers numbered node by node and bound to the cores of their node, idle workers steal from
+	// their own node first
+	bool groupByNode = false;
+};
+
+// every worker owns a deque: it pushes and pops its own tasks at the back and steals from the front
+// of the others when it runs dry. Tasks added from outside the pool go to a lock-free queue that all
+// workers drain, and round robin to the deques only when that queue is full.
+// Post() keeps small callables in slots of the pool's arena, so bursts of small tasks don't allocate.
+// Queues and deques come in one lane per priority. A task without an explicit priority gets the one of
+// the calling thread: the running task's on a worker, the PriorityScope's or Interactive elsewhere.
+// A pool with pinned or grouped workers is placed: PostTo() and LibParallel send a range to the same
+// worker every time, so the memory it first wrote stays on that worker's node
+class LibThreadPool {
+public:
+	LibThreadPool(size_t numThreads = std::thread::hardware_concurrency()) :
+		LibThreadPool(LibPoolOptions{ numThreads }) {}
 
-					task->Do();
-					complete++;
+	explicit LibThreadPool(const LibPoolOptions& options) :
+		workers(std::max<size_t>(options.threadsNum, 1)),
+		injected{ LibMPMCQueue<Task*>(m_InjectedCapacity), LibMPMCQueue<Task*>(m_InjectedCapacity) }, arena(m_ArenaSize),
+		placed(options.pinThreads || options.groupByNode),
+		stop(false), queued{ 0, 0 }, sleeping(0), helping(0), unfinished(0), finishWaiters(0), next(0) {
+		std::vector<LibAffinity::Core> cores = LibAffinity::Cores();
+		if (options.groupByNode) {
+			std::stable_sort(cores.begin(), cores.end(),
+				[](const LibAffinity::Core& a, const LibAffinity::Core& b) { return a.m_node < b.m_node; });
+		}
+		for (size_t i = 0; i < workers.size() && placed; i++) {
+			workers[i].core = cores[i % cores.size()].m_id;
+			workers[i].node = cores[i % cores.size()].m_node;
+		}
 
-					cv_wait.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			threads.emplace_back([this, i] { Run(i); });
+			if (options.pinThreads) {
+				LibAffinity::Bind(threads.back(), { workers[i].core });
+			}
+			else if (options.groupByNode) {
+				std::vector<size_t> nodeCores;
+				for (const LibAffinity::Core& core : cores) {
+					if (core.m_node == workers[i].node) {
+						nodeCores.push_back(core.m_id);
+					}
 				}
-			});
+				LibAffinity::Bind(threads.back(), nodeCores);
+			}
 		}
 	}
 
 	~LibThreadPool() {
 		StopPool();
+
+		// only tasks posted from outside after the workers left are still queued
+		for (size_t lane = 0; lane < m_LanesNum; lane++) {
+			Task* task;
+			while (injected[lane].TryPop(task)) {
+				Recycle(task);
+			}
+			for (Worker& worker : workers) {
+				for (Task* left : worker.tasks[lane]) {
+					Recycle(left);
+				}
+			}
+		}
+	}
+
+	// process-wide pool for callers that don't own one, started on first use
+	static LibThreadPool& Shared() {
+		static LibThreadPool pool;
+		return pool;
+	}
+
+	// sets the priority of the calling thread's tasks, LibTaskGroup and LibParallel, until it goes out
+	// of scope: a loader thread building an index under a Background scope leaves the pool to picks
+	class PriorityScope {
+	public:
+		explicit PriorityScope(LibPriority priority) : previous(currentPriority) {
+			currentPriority = priority;
+		}
+
+		PriorityScope(const PriorityScope&) = delete;
+		PriorityScope& operator=(const PriorityScope&) = delete;
+
+		~PriorityScope() {
+			currentPriority = previous;
+		}
+
+	private:
+		LibPriority previous;
+	};
+
+	static inline LibPriority CurrentPriority() {
+		return currentPriority;
 	}
 
 	void AddTask(std::unique_ptr<Task> task) {
-		std::unique_lock<std::mutex> lock(queueMutex);
+		AddTask(std::move(task), currentPriority);
+	}
+
+	void AddTask(std::unique_ptr<Task> task, LibPriority priority) {
+		Push(task.release(), priority);
+	}
 
-		LastId++;
-		tasks.push(std::move(task));
-		lock.unlock();
-		
-		cv_add.notify_one();
+	// func goes to an arena slot when it fits and one is free, to the heap otherwise. It must not throw,
+	// work that can goes through Submit or a LibTaskGroup, which hand the exception to the waiter
+	template<typename Func>
+	void Post(Func func) {
+		Post(currentPriority, std::move(func));
 	}
 
+	template<typename Func>
+	void Post(LibPriority priority, Func func) {
+		Push(MakeTask(std::move(func)), priority);
+	}
+
+	// func goes to the deque of the given worker; another worker, preferably of the same node, takes it
+	// only if that one is busy
+	template<typename Func>
+	void PostTo(size_t worker, LibPriority priority, Func func) {
+		PushTo(worker, MakeTask(std::move(func)), priority);
+	}
+
+	// the future becomes ready when func has run, an exception thrown by func is rethrown by get()
+	template<typename Func>
+	auto Submit(Func func) -> std::future<decltype(func())> {
+		std::packaged_task<decltype(func())()> job(std::move(func));
+		auto res = job.get_future();
+		Post(std::move(job));
+		return res;
+	}
+
+	inline size_t ThreadsNum() const {
+		return threads.size();
+	}
+
+	inline bool IsPlaced() const {
+		return placed;
+	}
+
+	inline size_t WorkerCore(size_t worker) const {
+		return workers[worker].core;
+	}
+
+	inline size_t WorkerNode(size_t worker) const {
+		return workers[worker].node;
+	}
+
+	// waits until the whole pool is idle, including tasks of other callers; prefer LibTaskGroup.
+	// Called from a task, it runs queued work until every unfinished task is one waiting here
 	void WaitForFinish() {
+		if (IsWorkerThread()) {
+			finishWaiters++;
+			HelpUntil([this] { return unfinished == finishWaiters; });
+			finishWaiters--;
+			return;
+		}
+
 		std::unique_lock<std::mutex> lock(waitMutex);
-		cv_wait.wait(lock, [this] { return tasks.empty() && complete == LastId; });
+		cv_wait.wait(lock, [this] { return unfinished == 0; });
+	}
+
+	inline bool IsWorkerThread() const {
+		return current == this;
+	}
+
+	// for waits on a worker: instead of blocking it, runs queued tasks until isDone(). Only lanes up to
+	// the waited work's priority or the waiter's own are helped, an interactive wait for interactive work
+	// never picks up a long background chunk. With nothing to run it polls a few times, then sleeps until
+	// a task is queued or one ends
+	template<typename Pred>
+	void HelpUntil(Pred isDone, LibPriority waited = LibPriority::Background) {
+		const size_t lanes = std::max(static_cast<size_t>(waited), static_cast<size_t>(currentPriority)) + 1;
+		size_t idlePolls = 0;
+		while (!isDone()) {
+			LibPriority priority;
+			if (Task* task = TakeTask(currentIndex, priority, lanes)) {
+				Execute(task, priority);
+				idlePolls = 0;
+			}
+			else if (++idlePolls < m_HelpPolls) {
+				std::this_thread::yield();
+			}
+			else {
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				helping++;
+				cv_help.wait_for(lock, m_HelpTimeout, [&] { return stop || IsQueued(lanes) || isDone(); });
+				helping--;
+			}
+		}
 	}
 
+	// the workers run what is queued, tasks queued by those included, before they are joined: a coroutine
+	// waiting in ResumeOn is resumed rather than dropped with its frame
 	void StopPool() {
-		stop = true;
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stop = true;
+		}
 
 		cv_add.notify_all();
+		cv_help.notify_all();
 		for (std::thread& thread : threads) {
-			thread.join();
+			if (thread.joinable()) {
+				thread.join();
+			}
 		}
 	}
 
 private:
+	static constexpr size_t m_LanesNum = 2;
+
+	struct Worker {
+		std::deque<Task*> tasks[m_LanesNum];
+		std::mutex mutex;
+		size_t core = 0;
+		size_t node = 0;
+	};
+
+	template<typename Func>
+	Task* MakeTask(Func&& func) {
+		if constexpr (LibInlineTask::Fits<Func>) {
+			if (LibInlineTask* slot = arena.Acquire()) {
+				slot->Set(std::move(func));
+				return slot;
+			}
+		}
+		return new LibFuncTask<Func>(std::move(func));
+	}
+
+	void Push(Task* task, LibPriority priority) {
+		unfinished++;
+
+		const size_t lane = static_cast<size_t>(priority);
+		if (current == this) {
+			PushToWorker(currentIndex, lane, task);
+		}
+		else if (!injected[lane].TryPush(task)) {
+			PushToWorker(next++ % workers.size(), lane, task);
+		}
+		Notify(lane);
+	}
+
+	void PushTo(size_t index, Task* task, LibPriority priority) {
+		unfinished++;
+		const size_t lane = static_cast<size_t>(priority);
+		PushToWorker(index % workers.size(), lane, task);
+		Notify(lane);
+	}
+
+	void Notify(size_t lane) {
+		// a worker going to sleep registers in sleeping before it checks queued, so one of the two
+		// sides always sees the other
+		queued[lane]++;
+		if (sleeping > 0 || helping > 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			cv_add.notify_one();
+			cv_help.notify_all();
+		}
+	}
+
+
+	// once stopped, a worker leaves only when nothing is queued
+	void Run(size_t index) {
+		current = this;
+		currentIndex = index;
+
+		for (;;) {
+			LibPriority priority;
+			Task* task = TakeTask(index, priority, m_LanesNum);
+			if (!task) {
+				if (stop) {
+					break;
+				}
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleeping++;
+				cv_add.wait(lock, [this] { return stop || IsQueued(m_LanesNum); });
+				sleeping--;
+				continue;
+			}
+
+			Execute(task, priority);
+		}
+	}
+
+	// the worker's priority is restored afterwards, a helping waiter goes on with its own task
+	void Execute(Task* task, LibPriority priority) {
+		LibPriority previous = currentPriority;
+		currentPriority = priority;
+		task->Do();
+		Recycle(task);
+		currentPriority = previous;
+
+		if (--unfinished == 0) {
+			std::lock_guard<std::mutex> lock(waitMutex);
+			cv_wait.notify_all();
+		}
+		if (helping > 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			cv_help.notify_all();
+		}
+	}
+
+	void PushToWorker(size_t index, size_t lane, Task* task) {
+		Worker& worker = workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks[lane].push_back(task);
+	}
+
+	void Recycle(Task* task) {
+		if (arena.Owns(task)) {
+			arena.Release(static_cast<LibInlineTask*>(task));
+		}
+		else {
+			delete task;
+		}
+	}
+
+	bool IsQueued(size_t lanes) const {
+		for (size_t lane = 0; lane < lanes; lane++) {
+			if (queued[lane] > 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// lane by lane up to lanes: own deque first (newest task, still in cache), then the submission queue,
+	// then the oldest task of the next workers, those of the same node before the others
+	Task* TakeTask(size_t index, LibPriority& priority, size_t lanes) {
+		Task* task = nullptr;
+		for (size_t lane = 0; !task && lane < lanes; lane++) {
+			{
+				Worker& own = workers[index];
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (!own.tasks[lane].empty()) {
+					task = own.tasks[lane].back();
+					own.tasks[lane].pop_back();
+				}
+			}
+
+			if (!task) {
+				injected[lane].TryPop(task);
+			}
+
+			for (int pass = 0; !task && pass < 2; pass++) {
+				for (size_t i = 1; !task && i < workers.size(); i++) {
+					Worker& victim = workers[(index + i) % workers.size()];
+					if ((victim.node == workers[index].node) != (pass == 0)) {
+						continue;
+					}
+					std::lock_guard<std::mutex> lock(victim.mutex);
+					if (!victim.tasks[lane].empty()) {
+						task = victim.tasks[lane].front();
+						victim.tasks[lane].pop_front();
+					}
+				}
+			}
+			priority = static_cast<LibPriority>(lane);
+		}
+
+		if (task) {
+			queued[static_cast<size_t>(priority)]--;
+		}
+		return task;
+	}
+
+	std::vector<Worker> workers;
 	std::vector<std::thread> threads;
-	std::queue<std::unique_ptr<Task>> tasks;
-	std::mutex queueMutex;
+	LibMPMCQueue<Task*> injected[m_LanesNum];
+	LibTaskArena arena;
+	const bool placed;
+
+	std::mutex sleepMutex;
 	std::condition_variable cv_add;
+	// waiters in HelpUntil, woken by new tasks and by every task that ends
+	std::condition_variable cv_help;
 
 	std::mutex waitMutex;
 	std::condition_variable cv_wait;
 
-	int LastId;
 	std::atomic<bool> stop;
-	std::atomic<int> complete;
+	// tasks waiting in each lane
+	std::atomic<int> queued[m_LanesNum];
+	std::atomic<int> sleeping;
+	std::atomic<int> helping;
+	std::atomic<int> unfinished;
+	std::atomic<int> finishWaiters;
+	std::atomic<size_t> next;
+
+	static constexpr size_t m_InjectedCapacity = 4096;
+	static constexpr size_t m_ArenaSize = 1024;
+	static constexpr size_t m_HelpPolls = 64;
+	// a finished task always wakes the waiters, the timeout only bounds a missed wake
+	static constexpr std::chrono::milliseconds m_HelpTimeout{ 1 };
+
+	// pool and deque of the calling thread, set for workers only
+	static inline thread_local LibThreadPool* current = nullptr;
+	static inline thread_local size_t currentIndex = 0;
+	// priority of the running task on a worker, of the innermost PriorityScope elsewhere
+	static inline thread_local LibPriority currentPriority = LibPriority::Interactive;
+};
+
+// tasks added through a group share the pool, Wait() returns once the group's own tasks are done
+// no matter what else the pool is running. A task may fork a group and wait on it: the worker runs
+// queued tasks meanwhile, so recursive fork-join never runs out of workers.
+// All tasks of a group have its priority, by default the one of the thread creating it.
+// The first exception thrown by a task is rethrown by Wait() once all tasks are done
+class LibTaskGroup {
+public:
+	explicit LibTaskGroup(LibThreadPool& threadPool, LibPriority prio = LibThreadPool::CurrentPriority()) :
+		tp(threadPool), priority(prio), pending(0) {}
+
+	LibTaskGroup(const LibTaskGroup&) = delete;
+	LibTaskGroup& operator=(const LibTaskGroup&) = delete;
+
+	// an exception nobody waited for is dropped
+	~LibTaskGroup() {
+		WaitAll();
+	}
+
+	void AddTask(std::unique_ptr<Task> task) {
+		Run([task = std::move(task)]() { task->Do(); });
+	}
+
+	template<typename Func>
+	void Run(Func func) {
+		tp.Post(priority, Wrap(std::move(func)));
+	}
+
+	// placed on the given worker, see LibThreadPool::PostTo
+	template<typename Func>
+	void RunOn(size_t worker, Func func) {
+		tp.PostTo(worker, priority, Wrap(std::move(func)));
+	}
+
+	void Wait() {
+		WaitAll();
+		std::exception_ptr err;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			err = std::exchange(error, nullptr);
+		}
+		if (err) {
+			std::rethrow_exception(err);
+		}
+	}
+
+private:
+	void WaitAll() {
+		if (tp.IsWorkerThread()) {
+			tp.HelpUntil([this] {
+				std::lock_guard<std::mutex> lock(mutex);
+				return pending == 0;
+			}, priority);
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		cv_done.wait(lock, [this] { return pending == 0; });
+	}
+
+	template<typename Func>
+	auto Wrap(Func func) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending++;
+		}
+
+		return [this, func = std::move(func)]() mutable {
+			try {
+				func();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			Done();
+		};
+	}
+
+	// the count only changes under the lock, so a waiter can't see zero and destroy the group
+	// before the last task has let go of it
+	void Done() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0) {
+			cv_done.notify_all();
+		}
+	}
 
+	LibThreadPool& tp;
+	const LibPriority priority;
+	std::mutex mutex;
+	std::condition_variable cv_done;
+	size_t pending;
+	std::exception_ptr error;
 };
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include "LibPoint.h"
+#include "LibVector.h"
+#include "LibTimer.h"
+#include "LibTrnglKernel.h"
+#include "LibUtility.h"
+#include "LibParallel.h"
+
+// per-triangle first vertex and edges in blocks of four, one SIMD step of LibTrnglKernel per block.
+// Queries stream the blocks instead of gathering points through the triangle indices.
+template<typename T>
+class LibTrnglCache {
+public:
+	using Pack = typename LibTrnglKernel<T>::Pack;
+	static constexpr size_t Size = LibTrnglKernel<T>::Size;
+
+	struct alignas(64) Block {
+		T m_v0[3][Size];
+		T m_e1[3][Size];
+		T m_e2[3][Size];
+	};
+
+	LibTrnglCache() = default;
+	~LibTrnglCache() = default;
+
+	inline size_t TrinaglesNum() const {
+		return m_trnglsCount;
+	}
+
+	using Blocks_t = std::vector<Block, LibDefaultInitAllocator<Block>>;
+
+	inline const Blocks_t& Blocks() const {
+		return m_vecBlocks;
+	}
+
+	template<typename I>
+	void Build(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls) {
+		TIMER_START("build triangle cache");
+		m_trnglsCount = trngls.size() / 3;
+
+		// lanes past the last triangle stay zero, degenerate triangles never hit
+		m_vecBlocks.assign((m_trnglsCount + Size - 1) / Size, Block{});
+		for (size_t i = 0; i < m_trnglsCount; i++) {
+			Fill(pts, trngls, i);
+		}
+		TIMER_END("build triangle cache");
+	}
+
+	// blocks are written through LibParallel, which hands a range of triangles to the same worker in every
+	// loop over them: on a placed pool each block is first touched by the worker that later scans it
+	template<typename I>
+	void Build(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, LibThreadPool& tp,
+		size_t grain) {
+		m_trnglsCount = trngls.size() / 3;
+		m_vecBlocks.clear();
+		m_vecBlocks.resize((m_trnglsCount + Size - 1) / Size);
+		LibParallel::For(tp, 0, m_trnglsCount, grain, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				Fill(pts, trngls, i);
+			}
+		});
+
+		// lanes past the last triangle were left unwritten
+		for (size_t lane = m_trnglsCount % Size; lane != 0 && lane < Size; lane++) {
+			Block& block = m_vecBlocks.back();
+			for (size_t axis = 0; axis < 3; axis++) {
+				block.m_v0[axis][lane] = block.m_e1[axis][lane] = block.m_e2[axis][lane] = 0;
+			}
+		}
+	}
+
+	bool IsIntersectionTrngl(const LibPoint<T>& org, const LibVector<T>& dir, size_t trngl, T& dist) const {
+		T u, v;
+		return IsIntersectionTrngl(org, dir, trngl, dist, u, v);
+	}
+
+	bool IsIntersectionTrngl(const LibPoint<T>& org, const LibVector<T>& dir, size_t trngl, T& dist, T& u, T& v) const {
+		const Block& block = m_vecBlocks[trngl / Size];
+		size_t lane = trngl % Size;
+		return LibTrnglKernel<T>::IsIntersection(org, dir,
+			LibPoint<T>(block.m_v0[0][lane], block.m_v0[1][lane], block.m_v0[2][lane]),
+			LibVector<T>(block.m_e1[0][lane], block.m_e1[1][lane], block.m_e1[2][lane]),
+			LibVector<T>(block.m_e2[0][lane], block.m_e2[1][lane], block.m_e2[2][lane]), dist, u, v);
+	}
+
+	// closest hit among triangles [begin, end), same contract as LibTrnglKernel::IsIntersectionRange
+	bool IsIntersectionRange(const LibPoint<T>& org, const LibVector<T>& dir, size_t begin, size_t end,
+		T& dist, size_t& ind) const {
+		return IsIntersectionRange(org, dir, begin, end, 0, dist, ind);
+	}
+
+	// closest hit in [tMin, dist), dist shrinks with every hit so later blocks are tested against a tighter bound
+	bool IsIntersectionRange(const LibPoint<T>& org, const LibVector<T>& dir, size_t begin, size_t end,
+		T tMin, T& dist, size_t& ind) const {
+		bool isFound = false;
+		size_t i = begin;
+		for (; i < end && i % Size != 0; i++) {
+			isFound = IsIntersectionScalar(org, dir, i, tMin, dist, ind) || isFound;
+		}
+
+		const Pack tMinPack(tMin);
+		for (; i + Size <= end; i += Size) {
+			const Block& block = m_vecBlocks[i / Size];
+			Pack v0[3], e1[3], e2[3];
+			LoadBlock(block, v0, e1, e2);
+
+			Pack t;
+			int bits = LibTrnglKernel<T>::IsIntersection4(org, dir, v0, e1, e2, tMinPack, Pack(dist), t);
+			isFound = LibTrnglKernel<T>::UpdateClosest(bits, t, i, dist, ind) || isFound;
+		}
+
+		for (; i < end; i++) {
+			isFound = IsIntersectionScalar(org, dir, i, tMin, dist, ind) || isFound;
+		}
+
+		return isFound;
+	}
+
+	// any hit in [0, tMax) among triangles [begin, end)
+	bool IsOccludedRange(const LibPoint<T>& org, const LibVector<T>& dir, size_t begin, size_t end, T tMax) const {
+		T dist;
+		size_t i = begin;
+		for (; i < end && i % Size != 0; i++) {
+			if (IsIntersectionTrngl(org, dir, i, dist) && dist < tMax) {
+				return true;
+			}
+		}
+
+		for (; i + Size <= end; i += Size) {
+			const Block& block = m_vecBlocks[i / Size];
+			Pack v0[3], e1[3], e2[3];
+			LoadBlock(block, v0, e1, e2);
+
+			Pack t;
+			if (LibTrnglKernel<T>::IsIntersection4(org, dir, v0, e1, e2, Pack(tMax), t) != 0) {
+				return true;
+			}
+		}
+
+		for (; i < end; i++) {
+			if (IsIntersectionTrngl(org, dir, i, dist) && dist < tMax) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// calls func(trngl, dist, u, v) for every hit among triangles [begin, end) in index order;
+	// blocks are filtered four at a time and only hit lanes are recomputed for the barycentrics
+	template<typename Func>
+	void ForEachHit(const LibPoint<T>& org, const LibVector<T>& dir, size_t begin, size_t end, Func func) const {
+		T dist, u, v;
+		size_t i = begin;
+		for (; i < end && i % Size != 0; i++) {
+			if (IsIntersectionTrngl(org, dir, i, dist, u, v)) {
+				func(i, dist, u, v);
+			}
+		}
+
+		const Pack tMax(std::numeric_limits<T>::max());
+		for (; i + Size <= end; i += Size) {
+			const Block& block = m_vecBlocks[i / Size];
+			Pack v0[3], e1[3], e2[3];
+			LoadBlock(block, v0, e1, e2);
+
+			Pack t;
+			int bits = LibTrnglKernel<T>::IsIntersection4(org, dir, v0, e1, e2, tMax, t);
+			for (size_t lane = 0; bits != 0; lane++, bits >>= 1) {
+				if ((bits & 1) && IsIntersectionTrngl(org, dir, i + lane, dist, u, v)) {
+					func(i + lane, dist, u, v);
+				}
+			}
+		}
+
+		for (; i < end; i++) {
+			if (IsIntersectionTrngl(org, dir, i, dist, u, v)) {
+				func(i, dist, u, v);
+			}
+		}
+	}
+
+private:
+	static void LoadBlock(const Block& block, Pack (&v0)[3], Pack (&e1)[3], Pack (&e2)[3]) {
+		for (size_t axis = 0; axis < 3; axis++) {
+			v0[axis] = Pack::Load(block.m_v0[axis]);
+			e1[axis] = Pack::Load(block.m_e1[axis]);
+			e2[axis] = Pack::Load(block.m_e2[axis]);
+		}
+	}
+
+	bool IsIntersectionScalar(const LibPoint<T>& org, const LibVector<T>& dir, size_t trngl, T tMin, T& dist, size_t& ind) const {
+		T curDist;
+		if (IsIntersectionTrngl(org, dir, trngl, curDist) && curDist >= tMin && curDist < dist) {
+			dist = curDist;
+			ind = trngl;
+			return true;
+		}
+		return false;
+	}
+
+	template<typename I>
+	void Fill(const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls, size_t i) {
+		Block& block = m_vecBlocks[i / Size];
+		size_t lane = i % Size;
+		const LibPoint<T>& A = pts[trngls[3 * i]];
+		const LibPoint<T>& B = pts[trngls[3 * i + 1]];
+		const LibPoint<T>& C = pts[trngls[3 * i + 2]];
+		for (size_t axis = 0; axis < 3; axis++) {
+			block.m_v0[axis][lane] = A.At(axis);
+			block.m_e1[axis][lane] = B.At(axis) - A.At(axis);
+			block.m_e2[axis][lane] = C.At(axis) - A.At(axis);
+		}
+	}
+
+	Blocks_t m_vecBlocks;
+	size_t m_trnglsCount = 0;
+};
+
+// copyable holder of a lazily built cache, Get() may be called from several threads at once.
+// Copies share the built cache until one of them is reset. The builder runs outside the lock, it may
+// wait on a thread pool whose workers call Get() themselves; racing builders keep the first result.
+template<typename Cache>
+class LibCacheSlot {
+public:
+	LibCacheSlot() = default;
+
+	LibCacheSlot(const LibCacheSlot& other) : m_cache(other.Peek()) {}
+
+	LibCacheSlot& operator=(const LibCacheSlot& other) {
+		if (this != &other) {
+			std::shared_ptr<const Cache> cache = other.Peek();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cache = cache;
+			m_version++;
+		}
+		return *this;
+	}
+
+	template<typename Builder>
+	std::shared_ptr<const Cache> Get(Builder builder) {
+		size_t version = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_cache) {
+				return m_cache;
+			}
+			version = m_version;
+		}
+		std::shared_ptr<const Cache> cache = builder();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_version != version) {
+			// reset while building, the result is of the old data
+			return cache;
+		}
+		if (!m_cache) {
+			m_cache = cache;
+		}
+		return m_cache;
+	}
+
+	void Reset() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cache.reset();
+		m_version++;
+	}
+
+private:
+	std::shared_ptr<const Cache> Peek() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache;
+	}
+
+	mutable std::mutex m_mutex;
+	std::shared_ptr<const Cache> m_cache;
+	size_t m_version = 0;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include "LibPoint.h"
+#include "LibVector.h"
+#include "LibEps.h"
+#include "LibSimd.h"
+
+// Moller-Trumbore ray/triangle test: ray parameter and barycentrics in one pass, no plane or normalization.
+// The direction must be normalized so that t is the distance along the ray.
+// Rays closer than eps to the triangle plane are rejected like in LibPlane.
+template<typename T>
+class LibTrnglKernel {
+public:
+	using Pack = LibPack4<T>;
+	static constexpr size_t Size = Pack::Size;
+
+	static bool IsIntersection(const LibPoint<T>& org, const LibVector<T>& dir,
+		const LibPoint<T>& A, const LibPoint<T>& B, const LibPoint<T>& C, T& t, T& u, T& v) {
+		return IsIntersection(org, dir, A, B - A, C - A, t, u, v);
+	}
+
+	// triangle given by its first vertex and the two edges leaving it
+	static bool IsIntersection(const LibPoint<T>& org, const LibVector<T>& dir,
+		const LibPoint<T>& A, const LibVector<T>& e1, const LibVector<T>& e2, T& t, T& u, T& v) {
+		LibVector<T> p = dir.CrossProduct(e2);
+		T det = e1.DotProduct(p);
+
+		LibVector<T> nrml = e1.CrossProduct(e2);
+		if (det * det <= Eps2() * nrml.DotProduct(nrml)) {
+			return false;
+		}
+		T invDet = 1 / det;
+
+		LibVector<T> s = org - A;
+		u = s.DotProduct(p) * invDet;
+		if (u < 0 || u > 1) {
+			return false;
+		}
+
+		LibVector<T> q = s.CrossProduct(e1);
+		v = dir.DotProduct(q) * invDet;
+		if (v < 0 || u + v > 1) {
+			return false;
+		}
+
+		t = e2.DotProduct(q) * invDet;
+		return t >= 0;
+	}
+
+	// one ray against four triangles, vtx[vertex][axis] holds the lanes; lanes hitting closer than tMax are set
+	static int IsIntersection4(const LibPoint<T>& org, const LibVector<T>& dir, const T (&vtx)[3][3][Size],
+		const Pack& tMax, Pack& t) {
+		Pack a[3], e1[3], e2[3];
+		for (size_t axis = 0; axis < 3; axis++) {
+			a[axis] = Pack::Load(vtx[0][axis]);
+			e1[axis] = Pack::Load(vtx[1][axis]) - a[axis];
+			e2[axis] = Pack::Load(vtx[2][axis]) - a[axis];
+		}
+		return IsIntersection4(org, dir, a, e1, e2, tMax, t);
+	}
+
+	// four triangles given by first vertices and edges, as stored by LibTrnglCache
+	static int IsIntersection4(const LibPoint<T>& org, const LibVector<T>& dir,
+		const Pack (&a)[3], const Pack (&e1)[3], const Pack (&e2)[3], const Pack& tMax, Pack& t) {
+		return IsIntersection4(org, dir, a, e1, e2, Pack(0), tMax, t);
+	}
+
+	// lanes hitting in [tMin, tMax) are set
+	static int IsIntersection4(const LibPoint<T>& org, const LibVector<T>& dir,
+		const Pack (&a)[3], const Pack (&e1)[3], const Pack (&e2)[3], const Pack& tMin, const Pack& tMax, Pack& t) {
+		const Pack o[3] = { Pack(org.X()), Pack(org.Y()), Pack(org.Z()) };
+		const Pack d[3] = { Pack(dir.X()), Pack(dir.Y()), Pack(dir.Z()) };
+		typename Pack::Mask isHit = Crossing4(o, d, a, e1, e2, t);
+		return (isHit & (t >= tMin) & (t < tMax)).Bits();
+	}
+
+	// the test itself, lane by lane with a ray and a triangle per lane: lanes whose ray crosses the plane of
+	// its triangle inside it are set, t is the distance along the ray whatever its sign
+	static typename Pack::Mask Crossing4(const Pack (&org)[3], const Pack (&dir)[3],
+		const Pack (&a)[3], const Pack (&e1)[3], const Pack (&e2)[3], Pack& t) {
+		Pack p[3], n[3];
+		Cross(dir, e2, p);
+		Cross(e1, e2, n);
+		Pack det = Dot(e1, p);
+		typename Pack::Mask isValid = det * det > Pack(Eps2()) * Dot(n, n);
+		Pack invDet = Pack(1) / det;
+
+		Pack s[3] = { org[0] - a[0], org[1] - a[1], org[2] - a[2] };
+		Pack u = Dot(s, p) * invDet;
+
+		Pack q[3];
+		Cross(s, e1, q);
+		Pack v = Dot(dir, q) * invDet;
+		t = Dot(e2, q) * invDet;
+
+		Pack zero(0);
+		return isValid & (u >= zero) & (v >= zero) & (u + v <= Pack(1));
+	}
+
+	// closest hit among triangles [begin, end), four per step (AVX in the Release builds, SSE2 otherwise);
+	// dist holds the current bound on input
+	template<typename I>
+	static bool IsIntersectionRange(const LibPoint<T>& org, const LibVector<T>& dir,
+		const std::vector<LibPoint<T>>& pts, const std::vector<I>& trngls,
+		size_t begin, size_t end, T& dist, size_t& ind) {
+		bool isFound = false;
+		size_t i = begin;
+		for (; i + Size <= end; i += Size) {
+			T vtx[3][3][Size];
+			for (size_t lane = 0; lane < Size; lane++) {
+				for (size_t k = 0; k < 3; k++) {
+					const LibPoint<T>& pt = pts[trngls[3 * (i + lane) + k]];
+					vtx[k][0][lane] = pt.X();
+					vtx[k][1][lane] = pt.Y();
+					vtx[k][2][lane] = pt.Z();
+				}
+			}
+
+			Pack t;
+			int bits = IsIntersection4(org, dir, vtx, Pack(dist), t);
+			isFound = UpdateClosest(bits, t, i, dist, ind) || isFound;
+		}
+
+		for (; i < end; i++) {
+			T t, u, v;
+			if (IsIntersection(org, dir, pts[trngls[3 * i]], pts[trngls[3 * i + 1]], pts[trngls[3 * i + 2]], t, u, v) &&
+				t < dist) {
+				dist = t;
+				ind = i;
+				isFound = true;
+			}
+		}
+
+		return isFound;
+	}
+
+	// takes the closest of the hit lanes, the lower lane wins a tie
+	static bool UpdateClosest(int bits, const Pack& t, size_t first, T& dist, size_t& ind) {
+		if (bits == 0) {
+			return false;
+		}
+
+		T lanes[Size];
+		t.Store(lanes);
+		bool isUpdated = false;
+		for (size_t lane = 0; lane < Size; lane++) {
+			if (((bits >> lane) & 1) && lanes[lane] < dist) {
+				dist = lanes[lane];
+				ind = first + lane;
+				isUpdated = true;
+			}
+		}
+		return isUpdated;
+	}
+
+private:
+	static Pack Dot(const Pack (&a)[3], const Pack (&b)[3]) {
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	static void Cross(const Pack (&a)[3], const Pack (&b)[3], Pack (&res)[3]) {
+		res[0] = a[1] * b[2] - a[2] * b[1];
+		res[1] = a[2] * b[0] - a[0] * b[2];
+		res[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	static T Eps2() {
+		return static_cast<T>(LibEps::eps * LibEps::eps);
+	}
+};
@@ -2,6 +2,68 @@
 
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+// value-initialization through this allocator is default-initialization: resize() leaves trivial
+// elements unwritten, so their pages are first touched by whoever fills them
+template<typename T>
+class LibDefaultInitAllocator : public std::allocator<T> {
+public:
+	template<typename U>
+	struct rebind {
+		using other = LibDefaultInitAllocator<U>;
+	};
+
+	LibDefaultInitAllocator() = default;
+
+	template<typename U>
+	LibDefaultInitAllocator(const LibDefaultInitAllocator<U>&) noexcept {}
+
+	template<typename U>
+	void construct(U* ptr) {
+		::new (static_cast<void*>(ptr)) U;
+	}
+
+	template<typename U, typename... Args>
+	void construct(U* ptr, Args&&... args) {
+		::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+	}
+};
+
+// storage aligned to Align bytes, for arrays read with aligned SIMD loads
+template<typename T, size_t Align>
+class LibAlignedAllocator {
+public:
+	using value_type = T;
+
+	template<typename U>
+	struct rebind {
+		using other = LibAlignedAllocator<U, Align>;
+	};
+
+	LibAlignedAllocator() = default;
+
+	template<typename U>
+	LibAlignedAllocator(const LibAlignedAllocator<U, Align>&) noexcept {}
+
+	T* allocate(size_t count) {
+		return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Align)));
+	}
+
+	void deallocate(T* ptr, size_t) noexcept {
+		::operator delete(ptr, std::align_val_t(Align));
+	}
+
+	template<typename U>
+	bool operator==(const LibAlignedAllocator<U, Align>&) const noexcept {
+		return true;
+	}
+};
 
 class LibUtility {
 public:
@@ -30,6 +92,16 @@ public:
 		in.read(reinterpret_cast<char*>(val), amount * sizeof(T));
 	}
 
+	// FNV-1a over the raw bytes, pass the previous result as seed to chain buffers
+	template<typename T>
+	static uint64_t Hash(const T* val, size_t amount, uint64_t seed = 14695981039346656037ull) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(val);
+		for (size_t i = 0; i < amount * sizeof(T); i++) {
+			seed = (seed ^ bytes[i]) * 1099511628211ull;
+		}
+		return seed;
+	}
+
 	template<typename T>
 	static void SaveBuf(std::ostream& out, const std::vector<T>& vec) {
 		size_t size = vec.size();
@@ -45,6 +117,52 @@ public:
 		LoadData(in, vec.data(), size);
 	}
 
+	// vec is written as Stored values, so the file layout does not depend on T
+	template<typename Stored, typename T>
+	static void SaveBufAs(std::ostream& out, const std::vector<T>& vec) {
+		size_t size = vec.size();
+		LibUtility::Save(out, size);
+		Stored chunk[m_ConvertChunk];
+		for (size_t first = 0; first < size; first += m_ConvertChunk) {
+			size_t count = std::min(m_ConvertChunk, size - first);
+			std::copy(vec.data() + first, vec.data() + first + count, chunk);
+			SaveData(out, chunk, count);
+		}
+	}
+
+	// sets failbit if a stored value does not fit in T
+	template<typename Stored, typename T>
+	static void LoadBufAs(std::istream& in, std::vector<T>& vec) {
+		size_t size = 0;
+		LibUtility::Load(in, size);
+		vec.clear();
+		vec.reserve(size);
+		Stored chunk[m_ConvertChunk];
+		for (size_t first = 0; first < size && in; first += m_ConvertChunk) {
+			size_t count = std::min(m_ConvertChunk, size - first);
+			LoadData(in, chunk, count);
+			for (size_t i = 0; i < count; i++) {
+				if (chunk[i] > std::numeric_limits<T>::max()) {
+					in.setstate(std::ios::failbit);
+					return;
+				}
+				vec.push_back(static_cast<T>(chunk[i]));
+			}
+		}
+	}
+
+	// FNV-1a of vec as if it were stored as Stored values
+	template<typename Stored, typename T>
+	static uint64_t HashAs(const std::vector<T>& vec, uint64_t seed = 14695981039346656037ull) {
+		Stored chunk[m_ConvertChunk];
+		for (size_t first = 0; first < vec.size(); first += m_ConvertChunk) {
+			size_t count = std::min(m_ConvertChunk, vec.size() - first);
+			std::copy(vec.data() + first, vec.data() + first + count, chunk);
+			seed = Hash(chunk, count, seed);
+		}
+		return seed;
+	}
+
 	template<typename T>
 	static void SaveVec(std::ostream& out, const std::vector<T>& vec) {
 		size_t size = vec.size();
@@ -66,4 +184,6 @@ public:
 		}
 	}
 
+private:
+	static constexpr size_t m_ConvertChunk = 1024;
 };
@@ -8,14 +8,17 @@ Camera::Camera() {
 
     m_ModelToScreen = LibMatrix<double>::IdentityMatrix();
     m_ScreenToModel = LibMatrix<double>::IdentityMatrix();
+
+    m_DiagLength = 0;
 }
 
-void Camera::Init(const LibModel<double>& model)
+void Camera::Init(std::shared_ptr<const LibModel<double>> model)
 {
-    m_model = model;
-    LibVector<double> diag = model.Diagonal();
+    m_model = std::move(model);
+    LibVector<double> diag = m_model->Diagonal();
 
     double maxDelta = diag.LengthVector();
+    m_DiagLength = maxDelta;
 
     m_Scale = m_aspectRatio;
     if (maxDelta != 0) {
@@ -82,7 +85,7 @@ LibVector<double> Camera::PxlToMdlVec(int x_px, int y_px)
 LibRay<double> Camera::GetRayFromPx(int x_px, int y_px)
 {
     LibPoint<double> origin = PxlToScrnPt(x_px, y_px);
-    origin.SetZ(2 * m_model.Diagonal().LengthVector());
+    origin.SetZ(2 * m_DiagLength);
     origin = LibMatrix<double>::MultPt(origin, m_ScreenToModel);
 
     LibVector<double> direction = LibMatrix<double>::MultVec(LibVector<double>(0, 0, -1), m_ScreenToModel);
@@ -91,10 +94,25 @@ LibRay<double> Camera::GetRayFromPx(int x_px, int y_px)
     return LibRay<double>(origin, direction);
 }
 
+void Camera::GetPickInterval(double& tNear, double& tFar) const
+{
+    // the ray starts at screen depth 2 * m_DiagLength and glOrtho shows depths in [-1, 1],
+    // screen lengths are m_Scale times model lengths
+    tNear = std::max(0.0, (2 * m_DiagLength - 1) / m_Scale);
+    tFar = (2 * m_DiagLength + 1) / m_Scale;
+}
+
 bool Camera::IsIntersRayWithModel(int x_px, int y_px, int& srfc)
 {
-    LibPoint<double> pt;
-    return m_model.IsIntersectionRay(GetRayFromPx(x_px, y_px), pt, srfc);
+    double tNear, tFar;
+    GetPickInterval(tNear, tFar);
+
+    LibHit<double> hit;
+    if (!m_model || !m_model->IsIntersectionRay(GetRayFromPx(x_px, y_px), tNear, tFar, hit)) {
+        return false;
+    }
+    srfc = hit.m_srfc;
+    return true;
 }
 
 void Camera::Scale(double coef)
@@ -130,6 +148,12 @@ void Camera::Apply() const
     glLoadMatrixd(MdlToScrn().Data());
 }
 
+void Camera::Apply(const LibVector<double>& origin) const
+{
+    LibMatrix<double> mtrx = LibMatrix<double>::TranslationInit(origin) * MdlToScrn();
+    glLoadMatrixd(mtrx.Data());
+}
+
 LibVector<double> Camera::VecOnSphere(int x, int y, double radius2)
 {
     LibPoint<double> pt = PxlToScrnPt(x, y);
@@ -10,7 +10,7 @@ class Camera
 public:
     Camera();
 
-    void Init(const LibModel<double>& model);
+    void Init(std::shared_ptr<const LibModel<double>> model);
 
     void Resize(int w, int h);
 
@@ -24,6 +24,9 @@ public:
 
     LibRay<double> GetRayFromPx(int x_px, int y_px);
 
+    // part of a pick ray between the near and far clipping planes
+    void GetPickInterval(double& tNear, double& tFar) const;
+
     bool IsIntersRayWithModel(int x_px, int y_px, int& srfc);
 
     const LibMatrix<double>& MdlToScrn() const;
@@ -40,6 +43,9 @@ public:
 
     void Apply() const;
 
+    // for vertices given relative to origin: the translation is folded into the matrix in double
+    void Apply(const LibVector<double>& origin) const;
+
 private:
     LibVector<double> VecOnSphere(int x, int y, double radius2);
 
@@ -54,6 +60,8 @@ private:
     LibMatrix<double> m_ModelToScreen;
     LibMatrix<double> m_ScreenToModel;
 
-    LibModel<double> m_model;
+    double m_DiagLength;
+
+    std::shared_ptr<const LibModel<double>> m_model;
 };
 
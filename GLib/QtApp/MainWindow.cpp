@@ -5,29 +5,136 @@ MainWindow::MainWindow(QWidget* parent) : QOpenGLWidget(parent) {
     setMouseTracking(true);
 }
 
+MainWindow::~MainWindow() {
+    *m_alive = false;
+}
+
 void MainWindow::LoadModel(const std::wstring& filePath)
 {
-    std::ifstream in(filePath, std::ios::binary);
-    if (!in.is_open()) {
-        qWarning() << "Can't open file: " << filePath.c_str();
-        return;
+    LoadModelAsync([filePath](LibModel<double>& mdl) {
+        std::ifstream in(filePath, std::ios::binary);
+        if (!in.is_open()) {
+            qWarning() << "Can't open file: " << filePath.c_str();
+            return false;
+        }
+        if (!mdl.Load(in)) {
+            qWarning() << "Can't read model: " << filePath.c_str();
+            return false;
+        }
+        return true;
+    });
+}
+
+void MainWindow::LoadModelAsync(std::function<bool(LibModel<double>&)> read)
+{
+    LoadPipeline(std::move(read), ++m_loadGeneration).Detach();
+}
+
+void MainWindow::SetModel(const LibModel<double>& mdl)
+{
+    std::shared_ptr<LibModel<double>> model = std::make_shared<LibModel<double>>(mdl);
+    model->BuildBVH(m_threadPool);
+    GpuBuffers buffers = PrepareBuffers(*model);
+    InstallModel(std::move(model), std::move(buffers));
+}
+
+// read on the pool, then the index and the normals with the GPU buffers side by side, then back on
+// the GUI thread. A newer load makes this one drop its result. The resume is queued on the application,
+// not on the widget, so it always runs: if the widget is gone by then it frees the frame instead.
+// The pool runs what is queued before it is destroyed with the widget, a load not started by then ends
+// on the worker without touching the widget
+LibAsyncTask<void> MainWindow::LoadPipeline(std::function<bool(LibModel<double>&)> read, uint64_t generation)
+{
+    std::shared_ptr<std::atomic<bool>> alive = m_alive;
+    co_await LibAsync::ResumeOn(m_threadPool, LibPriority::Background);
+    if (!*alive) {
+        co_return;
     }
 
-    if (!m_model.Points().empty()) {
-        m_model.Clear();
+    std::shared_ptr<LibModel<double>> mdl = std::make_shared<LibModel<double>>();
+    std::shared_ptr<GpuBuffers> buffers = std::make_shared<GpuBuffers>();
+    try {
+        if (!read(*mdl)) {
+            co_return;
+        }
+
+        std::vector<LibAsyncTask<void>> stages;
+        if (!mdl->Accel()) {
+            stages.push_back([](std::shared_ptr<LibModel<double>> mdl, LibThreadPool& tp) -> LibAsyncTask<void> {
+                mdl->BuildBVH(tp);
+                co_return;
+            }(mdl, m_threadPool));
+        }
+        stages.push_back([](std::shared_ptr<LibModel<double>> mdl, std::shared_ptr<GpuBuffers> buffers,
+            LibThreadPool& tp) -> LibAsyncTask<void> {
+            if (mdl->Normals().size() != mdl->Points().size()) {
+                mdl->ComputeNormals(tp);
+            }
+            *buffers = PrepareBuffers(*mdl);
+            co_return;
+        }(mdl, buffers, m_threadPool));
+        co_await LibAsync::WhenAll(m_threadPool, std::move(stages));
+    }
+    catch (const std::exception& e) {
+        qWarning() << "Failed to load the model: " << e.what();
+        co_return;
     }
 
-    m_model.Load(in);
-    in.close();
-    m_camera.Init(m_model);
-    m_upd = true;
+    co_await LibAsync::ResumeVia([alive](std::coroutine_handle<> handle) {
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [alive, handle]() {
+            if (*alive) {
+                handle.resume();
+            }
+            else {
+                handle.destroy();
+            }
+        }, Qt::QueuedConnection);
+    });
+    if (generation != m_loadGeneration) {
+        co_return;
+    }
+    InstallModel(std::move(mdl), std::move(*buffers));
+}
 
-    update();
+MainWindow::GpuBuffers MainWindow::PrepareBuffers(const LibModel<double>& mdl)
+{
+    GpuBuffers buffers;
+    LibAABB<double> box = mdl.BoundingBox();
+    if (!box.IsEmpty()) {
+        buffers.m_origin = box.Center().AsVector();
+    }
+
+    buffers.m_vertices.resize(mdl.Points().size() * 3);
+    for (size_t i = 0; i < mdl.Points().size(); i++)
+    {
+        LibVector<double> local = mdl.Points()[i].AsVector() - buffers.m_origin;
+        buffers.m_vertices[3 * i] = static_cast<float>(local.X());
+        buffers.m_vertices[3 * i + 1] = static_cast<float>(local.Y());
+        buffers.m_vertices[3 * i + 2] = static_cast<float>(local.Z());
+    }
+
+    buffers.m_normals.resize(mdl.Normals().size() * 3);
+    for (size_t i = 0; i < mdl.Normals().size(); i++)
+    {
+        buffers.m_normals[3 * i] = static_cast<float>(mdl.Normals()[i].X());
+        buffers.m_normals[3 * i + 1] = static_cast<float>(mdl.Normals()[i].Y());
+        buffers.m_normals[3 * i + 2] = static_cast<float>(mdl.Normals()[i].Z());
+    }
+    return buffers;
 }
 
-void MainWindow::SetModel(const LibModel<double>& mdl)
+void MainWindow::InstallModel(std::shared_ptr<const LibModel<double>> mdl, GpuBuffers&& buffers)
 {
-    m_model.SetModel(mdl);
+    m_picker.SetModel(mdl);
+    m_indSurfSel = -1;
+
+    m_model = std::move(mdl);
+    m_gpuBuffers = std::move(buffers);
+    m_drawOrigin = m_gpuBuffers.m_origin;
+    m_camera.Init(m_model);
+    m_upd = true;
+
+    update();
 }
 
 void MainWindow::initializeGL() {
@@ -102,56 +209,38 @@ void MainWindow::paintGL() {
         glGenVertexArrays(1, &m_vao);
         glBindVertexArray(m_vao);
 
-        std::vector<unsigned int> tr(3 * m_model.TrinaglesNum());
-        for (size_t i = 0; i < m_model.Triangles().size(); i++)
-        {
-            tr[i] = m_model.Triangles()[i];
-        }
-
+        static_assert(sizeof(LibModel<double>::Index) == sizeof(GLuint), "indices are drawn as GL_UNSIGNED_INT");
         glGenBuffers(1, &m_vboTriangles);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vboTriangles);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_model.Triangles().size() * sizeof(unsigned int),
-            tr.data(), GL_STATIC_DRAW);
-
-        std::vector<double> vertData(m_model.Points().size() * 3);
-        for (size_t i = 0; i < m_model.Points().size(); i++)
-        {
-            vertData[3 * i] = m_model.Points()[i].X();
-            vertData[3 * i + 1] = m_model.Points()[i].Y();
-            vertData[3 * i + 2] = m_model.Points()[i].Z();
-        }
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_model->Triangles().size() * sizeof(GLuint),
+            m_model->Triangles().data(), GL_STATIC_DRAW);
 
         glGenBuffers(1, &m_vboVertices);
         glBindBuffer(GL_ARRAY_BUFFER, m_vboVertices);
-        glBufferData(GL_ARRAY_BUFFER, vertData.size() * sizeof(double),
-            (void*)vertData.data(), GL_STATIC_DRAW);
-
-        std::vector<double> nrmlsData(m_model.Normals().size() * 3);
-        for (size_t i = 0; i < m_model.Normals().size(); i++)
-        {
-            nrmlsData[3 * i] = m_model.Normals()[i].X();
-            nrmlsData[3 * i + 1] = m_model.Normals()[i].Y();
-            nrmlsData[3 * i + 2] = m_model.Normals()[i].Z();
-        }
+        glBufferData(GL_ARRAY_BUFFER, m_gpuBuffers.m_vertices.size() * sizeof(float),
+            (void*)m_gpuBuffers.m_vertices.data(), GL_STATIC_DRAW);
 
         glGenBuffers(1, &m_vboNormals);
         glBindBuffer(GL_ARRAY_BUFFER, m_vboNormals);
-        glBufferData(GL_ARRAY_BUFFER, nrmlsData.size() * sizeof(double),
-            (void*)nrmlsData.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, m_gpuBuffers.m_normals.size() * sizeof(float),
+            (void*)m_gpuBuffers.m_normals.data(), GL_STATIC_DRAW);
+
+        // the GPU has its own copy now
+        m_gpuBuffers = GpuBuffers();
 
         glBindBuffer(GL_ARRAY_BUFFER, m_vboVertices);
         glEnableClientState(GL_VERTEX_ARRAY);
-        glVertexPointer(3, GL_DOUBLE, 0, NULL);
+        glVertexPointer(3, GL_FLOAT, 0, NULL);
 
         glBindBuffer(GL_ARRAY_BUFFER, m_vboNormals);
         glEnableClientState(GL_NORMAL_ARRAY);
-        glNormalPointer(GL_DOUBLE, 0, NULL);
+        glNormalPointer(GL_FLOAT, 0, NULL);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_vboTriangles);
     }
     glClear(GL_COLOR_BUFFER_BIT);
 
-    m_camera.Apply();
+    m_camera.Apply(m_drawOrigin);
 
     GLfloat mat_ambient[] = { 0.4f, 0.4f, 0.4f, 1.0f };
     GLfloat mat_diffuse[] = { 1.0f, 0.0f, 0.0f, 1.0f };
@@ -159,7 +248,7 @@ void MainWindow::paintGL() {
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
     glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
 
-    glDrawElements(GL_TRIANGLES, m_model.Triangles().size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, m_model->Triangles().size(), GL_UNSIGNED_INT, 0);
 
     if (m_indSurfSel != -1) {
         GLfloat mat_ambient2[] = { 0.6f, 0.6f, 0.6f, 1.0f };
@@ -167,12 +256,11 @@ void MainWindow::paintGL() {
 
         glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient2);
         glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse2);
-        LibModel<double>::Surface srfc = m_model.Surfaces()[m_indSurfSel];
+        LibModel<double>::Surface srfc = m_model->Surfaces()[m_indSurfSel];
 
         size_t size = 3 * (srfc.End() - srfc.Begin());
 
-        glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, (void*)(srfc.Begin() * 3 * sizeof(unsigned int)));
-        m_indSurfSel = -1;
+        glDrawElements(GL_TRIANGLES, size, GL_UNSIGNED_INT, (void*)(srfc.Begin() * 3 * sizeof(LibModel<double>::Index)));
     }
 }
 
@@ -200,14 +288,30 @@ void MainWindow::mousePressEvent(QMouseEvent* event)
     m_pressed = true;
 }
 
+// the pick runs on the pool, only the result of the newest request reaches m_indSurfSel
+void MainWindow::RequestHoverPick(const QPoint& pos)
+{
+    double tNear, tFar;
+    m_camera.GetPickInterval(tNear, tFar);
+    m_picker.Request(m_camera.GetRayFromPx(pos.x(), pos.y()), tNear, tFar,
+        [this](const LibHit<double>& hit, uint64_t generation) {
+            QMetaObject::invokeMethod(this, [this, hit, generation]() {
+                if (!m_picker.IsLatest(generation)) {
+                    return;
+                }
+                m_indSurfSel = hit.m_isHit ? hit.m_srfc : -1;
+                update();
+            }, Qt::QueuedConnection);
+        });
+}
+
 void MainWindow::mouseMoveEvent(QMouseEvent* event)
 {
-    m_camera.IsIntersRayWithModel(event->pos().x(), event->pos().y(), m_indSurfSel);
     if (m_lastMousePos != event->pos()) {
+        // the model is dragged while the cursor is over it, as reported by the last hover pick
         if (m_isDragTransl) {
             QPoint delta = event->pos() - m_lastMousePos;
-            int srfc;
-            if (m_camera.IsIntersRayWithModel(event->pos().x(), event->pos().y(), srfc)) {
+            if (m_indSurfSel != -1) {
                 m_camera.Translation(delta.x(), delta.y());
             }
         }
@@ -216,8 +320,8 @@ void MainWindow::mouseMoveEvent(QMouseEvent* event)
         }
         m_lastMousePos = event->pos();
     }
+    RequestHoverPick(event->pos());
     update();
-    
 }
 
 void MainWindow::mouseReleaseEvent(QMouseEvent* event)
@@ -232,17 +336,17 @@ void MainWindow::mouseReleaseEvent(QMouseEvent* event)
 
 void MainWindow::PaintModel()
 {
-    if (!m_model.Triangles().empty() && !m_model.Points().empty()) {
+    if (!m_model->Triangles().empty() && !m_model->Points().empty()) {
         glBegin(GL_TRIANGLES);
-        for (size_t i = 0; i < m_model.TrinaglesNum(); i++)
+        for (size_t i = 0; i < m_model->TrinaglesNum(); i++)
         {
-            const LibPoint<double>& A = m_model.GetPtInTrngl(i, 0);
-            const LibPoint<double>& B = m_model.GetPtInTrngl(i, 1);
-            const LibPoint<double>& C = m_model.GetPtInTrngl(i, 2);
+            const LibPoint<double>& A = m_model->GetPtInTrngl(i, 0);
+            const LibPoint<double>& B = m_model->GetPtInTrngl(i, 1);
+            const LibPoint<double>& C = m_model->GetPtInTrngl(i, 2);
 
-            const LibVector<double>& nA = m_model.GetNrmlsInTrngl(i, 0);
-            const LibVector<double>& nB = m_model.GetNrmlsInTrngl(i, 0);
-            const LibVector<double>& nC = m_model.GetNrmlsInTrngl(i, 0);
+            const LibVector<double>& nA = m_model->GetNrmlsInTrngl(i, 0);
+            const LibVector<double>& nB = m_model->GetNrmlsInTrngl(i, 0);
+            const LibVector<double>& nC = m_model->GetNrmlsInTrngl(i, 0);
 
             glNormal3d(nA.X(), nA.Y(), nA.Z());
             glVertex3d(A.X(), A.Y(), A.Z());
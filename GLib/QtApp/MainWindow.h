@@ -3,18 +3,26 @@
 #include <QOpenGLWidget>
 #include <QOpenGLFunctions_3_3_core.h>
 #include <QWheelEvent>
+#include <QCoreApplication>
 #include "Camera.h"
 #include "../GLib/LibModel.h"
+#include "../GLib/LibPickService.h"
+#include "../GLib/LibAsync.h"
 #include <fstream>
+#include <functional>
 
 class MainWindow : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core {
 	Q_OBJECT
 
 public:
     MainWindow(QWidget* parent = nullptr);
+    ~MainWindow() override;
 
     void LoadModel(const std::wstring& filePath);
 
+    // read(model) runs on the pool, the model is indexed and shown without blocking the GUI thread
+    void LoadModelAsync(std::function<bool(LibModel<double>&)> read);
+
     void SetModel(const LibModel<double>& mdl);
 
 protected:
@@ -30,10 +38,29 @@ protected:
     void mouseReleaseEvent(QMouseEvent* event) override;
 
 private:
+    // vertex and normal data as uploaded to the GPU, indices go up straight from the model. Vertices are
+    // floats relative to the centre of the model, which is added back in double by the camera matrix
+    struct GpuBuffers {
+        LibVector<double> m_origin;
+        std::vector<float> m_vertices;
+        std::vector<float> m_normals;
+    };
+
+    static GpuBuffers PrepareBuffers(const LibModel<double>& mdl);
+
+    LibAsyncTask<void> LoadPipeline(std::function<bool(LibModel<double>&)> read, uint64_t generation);
+
+    void InstallModel(std::shared_ptr<const LibModel<double>> mdl, GpuBuffers&& buffers);
+
     void PaintModel();
+
+    void RequestHoverPick(const QPoint& pos);
         
-    LibModel<double> m_model;
+    // shared with the camera and the picks in flight, never changed once installed
+    std::shared_ptr<const LibModel<double>> m_model = std::make_shared<const LibModel<double>>();
     Camera m_camera;
+    LibThreadPool m_threadPool;
+    LibPickService<double> m_picker{ m_model, m_threadPool };
 
     bool m_isDragTransl = false;
     bool m_isDragRotat = false;
@@ -47,8 +74,14 @@ private:
     GLuint m_vboTriangles;
 
     bool m_upd = false;
+    GpuBuffers m_gpuBuffers;
+    LibVector<double> m_drawOrigin;
     int m_indSurfSel = -1;
 
+    uint64_t m_loadGeneration = 0;
+    // cleared by the destructor, loads still in flight free themselves instead of coming back
+    std::shared_ptr<std::atomic<bool>> m_alive = std::make_shared<std::atomic<bool>>(true);
+
     bool m_pressed = false;
 };
 
@@ -62,45 +62,52 @@ void QtApp::OpenZip()
         qDebug() << "The file is not selected";
         return;
     }
-    
+
+    // unpacked and parsed on the pool, MainWindow shows the model when it is indexed
+    widget->LoadModelAsync([zipName = zipName.toStdString()](LibModel<double>& model) {
+        return ReadZipBody(zipName, model);
+    });
+}
+
+bool QtApp::ReadZipBody(const std::string& zipName, LibModel<double>& model)
+{
     mz_zip_archive zipArchive;
     memset(&zipArchive, 0, sizeof(zipArchive));
 
-    mz_bool status = mz_zip_reader_init_file(&zipArchive, &zipName.toStdString()[0], 0);
+    mz_bool status = mz_zip_reader_init_file(&zipArchive, zipName.c_str(), 0);
     if (!status) {
         qDebug() << "Failed to initialize ZIP archive.";
-        return;
+        return false;
     }
 
     int pos = mz_zip_reader_locate_file(&zipArchive, "body0", nullptr, 0);
     if (pos < 0) {
         qDebug() << "File body0 not found in the archive.";
         mz_zip_reader_end(&zipArchive);
-        return;
+        return false;
     }
 
     mz_zip_archive_file_stat fileInfo;
     if (!mz_zip_reader_file_stat(&zipArchive, pos, &fileInfo)) {
         qDebug() << "Failed to get file info.";
         mz_zip_reader_end(&zipArchive);
-        return;
+        return false;
     }
 
     std::vector<char> buffer(fileInfo.m_uncomp_size);
     if (!mz_zip_reader_extract_to_mem(&zipArchive, pos, buffer.data(), buffer.size(), 0)) {
         qDebug() << "Failed to extract file to memory.";
         mz_zip_reader_end(&zipArchive);
-        return;
+        return false;
     }
 
     mz_zip_reader_end(&zipArchive);
 
     std::istringstream stream(std::string(buffer.begin(), buffer.end()));
 
-    LibModel<double> model;
     std::vector<LibPoint<double>> pts;
     std::vector<LibVector<double>> nrmls;
-    std::vector<size_t> trngls;
+    std::vector<LibModel<double>::Index> trngls;
     std::vector<LibModel<double>::Surface> srfcs;
 
     char header[4];
@@ -155,7 +162,10 @@ void QtApp::OpenZip()
     size_t ind;
     for (int i = 0; i < trngls.size(); ++i) {
         stream.read((char*)(&ind), sizeof(size_t));
-        trngls[i] = ind;
+        if (ind >= pts.size()) {
+            return false;
+        }
+        trngls[i] = static_cast<LibModel<double>::Index>(ind);
     }
 
     for (int i = 0; i < srfcs.size(); ++i) {
@@ -174,7 +184,5 @@ void QtApp::OpenZip()
     model.SetNormals(nrmls);
     model.SetTriangles(trngls);
     model.SetSurfaces(srfcs);
-
-    widget->SetModel(model);
-
+    return true;
 }
\ No newline at end of file
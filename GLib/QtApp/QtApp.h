@@ -17,6 +17,9 @@ private slots:
     void OpenZip();
 
 private:
+    // body0 of an IMV archive, called on a pool thread
+    static bool ReadZipBody(const std::string& zipName, LibModel<double>& model);
+
     void AddMenu();
     void AddMainWindow();
 